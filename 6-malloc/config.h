@@ -110,10 +110,16 @@
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
+/*
+ * Maximum bytes in the simulated mmap area (see mem_map in memlib.c)
+ */
+#define MAX_MAP (100*(1<<20))  /* 100 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FMONO  1   /* invariant TSC or CLOCK_MONOTONIC_RAW, median of runs */
+#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
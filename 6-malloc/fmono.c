@@ -0,0 +1,189 @@
+/*
+ * fmono.c - Time a function on a modern x86-64 or other Linux box
+ *
+ * The clock is rdtscp where the TSC is invariant, that is, it ticks at
+ * a constant rate through frequency changes and sleep states, and is
+ * calibrated against CLOCK_MONOTONIC_RAW. Elsewhere it is
+ * CLOCK_MONOTONIC_RAW itself, which NTP does not slew.
+ *
+ * fmono() pins the calling thread to the cpu it is on while it runs,
+ * so the runs see one cache hierarchy and one TSC. It runs the function
+ * FMONO_WARMUP times untimed to warm caches and page tables, then times
+ * runs until the 95% confidence interval of their median is within
+ * FMONO_EPSILON of it, or FMONO_MAXRUNS runs are done. The interval
+ * comes from order statistics, so it holds whatever the spread of the
+ * runs looks like, and one run hit by an interrupt does not move it.
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "fmono.h"
+
+#define FMONO_WARMUP    2       /* untimed runs first */
+#define FMONO_MINRUNS   5       /* timed runs at least */
+#define FMONO_MAXRUNS   31      /* timed runs at most */
+#define FMONO_EPSILON   0.01    /* wanted interval half width / median */
+#define FMONO_CALIBRATE 0.05    /* seconds spent calibrating the TSC */
+
+static int use_tsc = 0;         /* 1 if the clock is rdtscp */
+static double tsc_hz = 0;       /* its rate */
+
+/* function prototypes */
+static double raw_secs(void);
+static int has_invariant_tsc(void);
+static uint64_t read_tsc(void);
+static double now(void);
+static int cmp_double(const void *a, const void *b);
+
+/*
+ * raw_secs - Return CLOCK_MONOTONIC_RAW in seconds
+ */
+static double raw_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * has_invariant_tsc - Return whether the cpu has rdtscp and an
+ *     invariant TSC
+ */
+static int has_invariant_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+
+    if (!__get_cpuid(0x80000001, &a, &b, &c, &d) || !(d & (1u << 27)))
+        return 0;
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8));
+#else
+    return 0;
+#endif
+}
+
+/*
+ * read_tsc - Read the TSC once the instructions before have finished,
+ *     and keep those after from starting early
+ */
+static uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi, aux;
+
+    asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux)
+                 : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * now - Return the time in seconds on the chosen clock
+ */
+static double now(void)
+{
+    return use_tsc ? read_tsc() / tsc_hz : raw_secs();
+}
+
+/*
+ * init_fmono - Use the TSC if it is invariant, after measuring its rate
+ *     against CLOCK_MONOTONIC_RAW
+ */
+void init_fmono(int verbose)
+{
+    double t0, t1;
+    uint64_t c0, c1;
+
+    use_tsc = 0;
+    if (has_invariant_tsc()) {
+        t0 = raw_secs();
+        c0 = read_tsc();
+        while ((t1 = raw_secs()) - t0 < FMONO_CALIBRATE)
+            ;
+        c1 = read_tsc();
+        tsc_hz = (c1 - c0) / (t1 - t0);
+        use_tsc = tsc_hz > 0;
+    }
+
+    if (verbose) {
+        if (use_tsc)
+            printf("Measuring performance with the invariant TSC "
+                   "(%.1f MHz).\n", tsc_hz / 1e6);
+        else
+            printf("Measuring performance with CLOCK_MONOTONIC_RAW.\n");
+    }
+}
+
+/*
+ * cmp_double - Order doubles for qsort
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * fmono - Time f(argp) as described at the top of the file
+ */
+double fmono(fmono_test_funct f, void *argp, fmono_result_t *res)
+{
+    double times[FMONO_MAXRUNS], sorted[FMONO_MAXRUNS];
+    double start, median = 0, lo = 0, hi = 0;
+    cpu_set_t old, one;
+    int pinned = 0, cpu, i, n, j, k;
+
+    /* stay on the current cpu, within what we may run on */
+    if ((cpu = sched_getcpu()) >= 0 &&
+        sched_getaffinity(0, sizeof(old), &old) == 0) {
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pinned = sched_setaffinity(0, sizeof(one), &one) == 0;
+    }
+
+    for (i = 0; i < FMONO_WARMUP; i++)
+        f(argp);
+
+    for (n = 0; n < FMONO_MAXRUNS; ) {
+        start = now();
+        f(argp);
+        times[n++] = now() - start;
+        if (n < FMONO_MINRUNS)
+            continue;
+
+        /* ranks of the interval: n/2 -+ 1.96 sqrt(n)/2, as the count
+           of runs below the true median is binomial(n, 1/2) */
+        memcpy(sorted, times, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), cmp_double);
+        median = n % 2 ? sorted[n / 2] :
+                 (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+        j = (int)floor(n / 2.0 - 0.98 * sqrt(n));
+        k = (int)ceil(n / 2.0 + 0.98 * sqrt(n)) - 1;
+        lo = sorted[j < 0 ? 0 : j];
+        hi = sorted[k >= n ? n - 1 : k];
+        if (hi - lo <= 2 * FMONO_EPSILON * median)
+            break;
+    }
+
+    if (pinned)
+        sched_setaffinity(0, sizeof(old), &old);
+
+    if (res != NULL) {
+        res->median = median;
+        res->lo = lo;
+        res->hi = hi;
+        res->runs = n;
+    }
+    return median;
+}
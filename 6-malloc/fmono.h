@@ -0,0 +1,22 @@
+/*
+ * fmono.h - prototypes for the routines in fmono.c, which time a test
+ *     function on the invariant TSC or CLOCK_MONOTONIC_RAW and report
+ *     the median run with a confidence interval
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*fmono_test_funct)(void *);
+
+/* What fmono() found for one test function, in seconds */
+typedef struct {
+    double median;      /* median of the timed runs */
+    double lo, hi;      /* 95% confidence interval of the median */
+    int runs;           /* timed runs it took */
+} fmono_result_t;
+
+/* Pick the clock, calibrating the TSC if it is used; verbose says which */
+void init_fmono(int verbose);
+
+/* Return the median running time of f(argp) in seconds, and fill in
+   *res if it is not NULL */
+double fmono(fmono_test_funct f, void *argp, fmono_result_t *res);
@@ -6,9 +6,13 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fmono.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+#if USE_FMONO
+static fmono_result_t last; /* what fmono found on the last call */
+#endif
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -19,7 +23,9 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
+#if USE_FMONO
+    init_fmono(verbose);
+#elif USE_FCYC
     if (verbose)
 	printf("Measuring performance with a cycle counter.\n");
 
@@ -44,7 +50,9 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
+#if USE_FMONO
+    return fmono(f, argp, &last);
+#elif USE_FCYC
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
 #elif USE_ITIMER
@@ -54,4 +62,18 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
-
+/*
+ * fsecs_interval - Put the 95% confidence interval of the last fsecs()
+ *     time in *lo and *hi, and return the runs it took; or return 0 if
+ *     the timer gives no interval
+ */
+int fsecs_interval(double *lo, double *hi)
+{
+#if USE_FMONO
+    *lo = last.lo;
+    *hi = last.hi;
+    return last.runs;
+#else
+    return 0;
+#endif
+}
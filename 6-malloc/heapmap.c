@@ -0,0 +1,281 @@
+/*
+ * heapmap.c - heap layout samples taken with mm_walk()
+ *
+ * A sample splits a power of 2 span from the heap start, the smallest
+ * that holds the heap, into HEAPMAP_COLS columns and keeps the free and
+ * slab share of each. Spans only double as the heap grows, so a column
+ * of a small sample always lies inside one column of a larger span, and
+ * every sample can be drawn to the scale of the largest heap.
+ * Heap bytes that mm_walk() does not report, such as the free list
+ * array before the prologue, count as used.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "heapmap.h"
+#include "memlib.h"
+#include "mm.h"
+
+#define HEAPMAP_MIN_SPAN  (64 * 1024)
+#define SVG_CELL_W        3     /* pixels per SVG column */
+#define SVG_ROW_H         2     /* pixels per SVG sample row */
+#define SVG_PLOT_W        120   /* width of the fragmentation plot */
+
+/* What the walk callback adds up */
+typedef struct {
+    heapsample_t *s;
+    char *lo;                   /* heap start */
+    size_t width;               /* bytes per column */
+    size_t free_col[HEAPMAP_COLS];
+    size_t slab_col[HEAPMAP_COLS];
+} walk_t;
+
+static void walk_block(void *arg, const void *start, size_t size, int kind);
+static int free_class(size_t size);
+static void sample_cols(const heapsample_t *s, size_t span, int cols,
+                        int col, double *heap, double *idle, double *slab);
+
+/*
+ * heapmap_init - Make hm empty
+ */
+void heapmap_init(heapmap_t *hm)
+{
+    hm->samples = NULL;
+    hm->n = hm->max = 0;
+}
+
+/*
+ * heapmap_free - Release the samples of hm
+ */
+void heapmap_free(heapmap_t *hm)
+{
+    free(hm->samples);
+    heapmap_init(hm);
+}
+
+/*
+ * heapmap_sample - Walk the heap and add what it looks like after op
+ *     ops to hm
+ */
+void heapmap_sample(heapmap_t *hm, long op)
+{
+    heapsample_t *s;
+    walk_t w = { 0 };
+    int i;
+
+    if (hm->n == hm->max) {
+        hm->max = hm->max ? 2 * hm->max : 64;
+        if ((s = realloc(hm->samples, hm->max * sizeof(*s))) == NULL) {
+            hm->max = hm->n;
+            return;
+        }
+        hm->samples = s;
+    }
+    s = &hm->samples[hm->n++];
+    memset(s, 0, sizeof(*s));
+    s->op = op;
+    s->heap = mem_heapsize();
+    for (s->span = HEAPMAP_MIN_SPAN; s->span < s->heap; s->span *= 2)
+        ;
+
+    w.s = s;
+    w.lo = mem_heap_lo();
+    w.width = s->span / HEAPMAP_COLS;
+    mm_walk(walk_block, &w);
+
+    for (i = 0; i < HEAPMAP_COLS; i++) {
+        s->free_col[i] = (uint16_t)((double)w.free_col[i] * 65535 / w.width);
+        s->slab_col[i] = (uint16_t)((double)w.slab_col[i] * 65535 / w.width);
+    }
+}
+
+/*
+ * walk_block - Add one block from mm_walk() to the sample in arg
+ */
+static void walk_block(void *arg, const void *start, size_t size, int kind)
+{
+    walk_t *w = arg;
+    size_t lo = (const char *)start - w->lo;
+    size_t hi = lo + size;
+    size_t col, end, *cols;
+
+    if (kind == MM_BLOCK_FREE) {
+        w->s->free += size;
+        if (size > w->s->largest)
+            w->s->largest = size;
+        w->s->nfree[free_class(size)]++;
+        cols = w->free_col;
+    } else if (kind == MM_BLOCK_SLAB) {
+        w->s->slab += size;
+        cols = w->slab_col;
+    } else {
+        return;
+    }
+
+    /* spread the block over the columns it covers */
+    for (col = lo / w->width; lo < hi && col < HEAPMAP_COLS; col++) {
+        end = (col + 1) * w->width;
+        if (end > hi)
+            end = hi;
+        cols[col] += end - lo;
+        lo = end;
+    }
+}
+
+/*
+ * free_class - Return the class of a free block: below 64 bytes, then
+ *     4x wider each, and the last one everything from 256 KB up
+ */
+static int free_class(size_t size)
+{
+    int c;
+
+    if (size < 64)
+        return 0;
+    c = (63 - __builtin_clzll(size) - 6) / 2 + 1;
+    return c < HEAPMAP_CLASSES ? c : HEAPMAP_CLASSES - 1;
+}
+
+/*
+ * sample_cols - Find the heap, free (idle) and slab bytes of s in column col
+ *     of cols over span, which is at least the span of s
+ */
+static void sample_cols(const heapsample_t *s, size_t span, int cols,
+                        int col, double *heap, double *idle, double *slab)
+{
+    double width = (double)span / cols;
+    double w = (double)s->span / HEAPMAP_COLS;
+    double lo = col * width;
+    int k, k_hi;
+
+    *heap = s->heap - lo;
+    if (*heap > width)
+        *heap = width;
+    *idle = *slab = 0;
+    if (*heap <= 0) {
+        *heap = 0;
+        return;
+    }
+    k_hi = (int)((lo + width) / w);
+    for (k = (int)(lo / w); k < k_hi && k < HEAPMAP_COLS; k++) {
+        *idle += s->free_col[k] * w / 65535;
+        *slab += s->slab_col[k] * w / 65535;
+    }
+}
+
+/*
+ * heapmap_print - Print a line per sample of hm: heap size, free bytes,
+ *     largest free block, external fragmentation (the free bytes not in
+ *     the largest block), free blocks per class, and a heap map of cols
+ *     columns, all to the scale of the largest heap
+ */
+void heapmap_print(FILE *fp, const heapmap_t *hm, int cols)
+{
+    size_t span = HEAPMAP_MIN_SPAN;
+    double heap, idle, slab;
+    const heapsample_t *s;
+    int i, j;
+
+    for (i = 0; i < hm->n; i++)
+        if (hm->samples[i].span > span)
+            span = hm->samples[i].span;
+
+    fprintf(fp, "  map: %d columns of %.0f KB, '#' used, '+' half used, "
+            "'-' mostly free, '.' free, 's' slab\n", cols, span / 1024.0 / cols);
+    fprintf(fp, "%10s%8s%8s%8s%6s%6s%5s%5s%5s%5s%5s%6s%6s  %s\n",
+            "op", "heapKB", "freeKB", "largest", "frag", "<64", "<256",
+            "<1K", "<4K", "<16K", "<64K", "<256K", "more", "map");
+    for (i = 0; i < hm->n; i++) {
+        s = &hm->samples[i];
+        fprintf(fp, "%10ld%8.0f%8.0f%8.0f%5.0f%%", s->op, s->heap / 1024.0,
+                s->free / 1024.0, s->largest / 1024.0,
+                s->free ? 100.0 * (s->free - s->largest) / s->free : 0);
+        for (j = 0; j < HEAPMAP_CLASSES; j++)
+            fprintf(fp, j == 0 || j >= 6 ? "%6zu" : "%5zu", s->nfree[j]);
+        fprintf(fp, "  ");
+        for (j = 0; j < cols; j++) {
+            sample_cols(s, span, cols, j, &heap, &idle, &slab);
+            if (heap == 0)
+                break;
+            fputc(2 * slab > heap ? 's' :
+                  16 * idle < heap ? '#' :
+                  2 * idle < heap ? '+' :
+                  16 * idle < 15 * heap ? '-' : '.', fp);
+        }
+        fputc('\n', fp);
+    }
+}
+
+/*
+ * heapmap_svg - Draw hm to path as an SVG image: a row per sample with
+ *     used, free and slab bytes in blue, grey and orange, and beside it
+ *     the external fragmentation over the trace. Return 0, or -1 if the
+ *     file cannot be written.
+ */
+int heapmap_svg(const char *path, const heapmap_t *hm, const char *title)
+{
+    size_t span = HEAPMAP_MIN_SPAN;
+    double heap, idle, slab, used;
+    int rgb[HEAPMAP_COLS], i, j, k, n, x0, ok;
+    const heapsample_t *s;
+    FILE *fp;
+    int map_w = HEAPMAP_COLS * SVG_CELL_W;
+    int top = 30, h = hm->n * SVG_ROW_H;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        return -1;
+
+    for (i = 0; i < hm->n; i++)
+        if (hm->samples[i].span > span)
+            span = hm->samples[i].span;
+
+    fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+            "width=\"%d\" height=\"%d\" font-family=\"monospace\" "
+            "font-size=\"11\">\n", map_w + SVG_PLOT_W + 30, top + h + 20);
+    fprintf(fp, "<text x=\"0\" y=\"12\">%s: %d samples, %.0f KB across; "
+            "used blue, free grey, slab orange</text>\n",
+            title, hm->n, span / 1024.0);
+
+    for (i = 0; i < hm->n; i++) {
+        s = &hm->samples[i];
+        for (n = 0; n < HEAPMAP_COLS; n++) {
+            sample_cols(s, span, HEAPMAP_COLS, n, &heap, &idle, &slab);
+            if (heap == 0)
+                break;
+            used = heap - idle - slab;
+            rgb[n] = (int)((50 * used + 230 * idle + 220 * slab) / heap) << 16 |
+                     (int)((80 * used + 230 * idle + 130 * slab) / heap) << 8 |
+                     (int)((160 * used + 230 * idle + 40 * slab) / heap);
+        }
+        /* one rect per run of equal colour */
+        for (j = 0; j < n; j = k) {
+            for (k = j + 1; k < n && rgb[k] == rgb[j]; k++)
+                ;
+            fprintf(fp, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+                    "fill=\"#%06x\"/>\n", j * SVG_CELL_W, top + i * SVG_ROW_H,
+                    (k - j) * SVG_CELL_W, SVG_ROW_H, rgb[j]);
+        }
+    }
+
+    /* external fragmentation, 0 to 100% left to right */
+    x0 = map_w + 20;
+    fprintf(fp, "<text x=\"%d\" y=\"%d\">frag %%</text>\n", x0, top - 4);
+    fprintf(fp, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+            "fill=\"none\" stroke=\"#999\"/>\n", x0, top, SVG_PLOT_W, h);
+    fprintf(fp, "<polyline fill=\"none\" stroke=\"#c00\" points=\"");
+    for (i = 0; i < hm->n; i++) {
+        s = &hm->samples[i];
+        fprintf(fp, "%.1f,%d ", x0 + (s->free ? (double)SVG_PLOT_W *
+                (s->free - s->largest) / s->free : 0),
+                top + i * SVG_ROW_H + SVG_ROW_H / 2);
+    }
+    fprintf(fp, "\"/>\n");
+    if (hm->n > 0)
+        fprintf(fp, "<text x=\"0\" y=\"%d\">op %ld to %ld</text>\n",
+                top + h + 14, hm->samples[0].op, hm->samples[hm->n - 1].op);
+    fprintf(fp, "</svg>\n");
+
+    ok = !ferror(fp);
+    ok &= fclose(fp) == 0;
+    return ok ? 0 : -1;
+}
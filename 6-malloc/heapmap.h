@@ -0,0 +1,33 @@
+/*
+ * heapmap.h - samples of the heap layout over a trace, printed as a
+ *     fragmentation timeline with an ASCII heap map, or drawn as SVG
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#define HEAPMAP_COLS     256    /* heap map columns kept per sample */
+#define HEAPMAP_CLASSES    8    /* free block classes, 4x apart from 64 */
+
+/* The heap after some op */
+typedef struct {
+    long op;                    /* ops done when it was taken */
+    size_t heap;                /* heap bytes */
+    size_t span;                /* power of 2 the columns split, >= heap */
+    size_t free;                /* bytes in free blocks */
+    size_t largest;             /* largest free block */
+    size_t slab;                /* bytes in slab runs */
+    size_t nfree[HEAPMAP_CLASSES];  /* free blocks per class */
+    uint16_t free_col[HEAPMAP_COLS]; /* free share of each column, /65535 */
+    uint16_t slab_col[HEAPMAP_COLS]; /* slab share of each column */
+} heapsample_t;
+
+typedef struct {
+    heapsample_t *samples;
+    int n, max;
+} heapmap_t;
+
+void heapmap_init(heapmap_t *hm);
+void heapmap_sample(heapmap_t *hm, long op);
+void heapmap_print(FILE *fp, const heapmap_t *hm, int cols);
+int heapmap_svg(const char *path, const heapmap_t *hm, const char *title);
+void heapmap_free(heapmap_t *hm);
@@ -0,0 +1,103 @@
+/*
+ * lathist.c - log-linear latency histograms
+ *
+ * Values below 2^LAT_SUB_BITS get a bucket each. Above that, every
+ * power of 2 is split into 2^LAT_SUB_BITS buckets of equal width, so a
+ * bucket is never wider than 1/32 of the values in it and the whole
+ * 64-bit range fits in LAT_BUCKETS counters.
+ */
+#include "lathist.h"
+
+#define LAT_SUB  (1 << LAT_SUB_BITS)
+
+/*
+ * lat_bucket - Return the bucket of value
+ */
+static int lat_bucket(uint64_t value)
+{
+    int e;
+
+    if (value < LAT_SUB)
+        return (int)value;
+    e = 63 - __builtin_clzll(value);
+    return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+           (int)(value >> (e - LAT_SUB_BITS)) - LAT_SUB;
+}
+
+/*
+ * lat_bucket_hi - Return the largest value in bucket b
+ */
+static uint64_t lat_bucket_hi(int b)
+{
+    int shift;
+
+    if (b < LAT_SUB)
+        return (uint64_t)b;
+    shift = (b >> LAT_SUB_BITS) - 1;
+    return (((uint64_t)(b & (LAT_SUB - 1)) + LAT_SUB + 1) << shift) - 1;
+}
+
+/*
+ * lat_record - Count value in h
+ */
+void lat_record(lathist_t *h, uint64_t value)
+{
+    h->count[lat_bucket(value)]++;
+    h->total++;
+    if (value > h->max)
+        h->max = value;
+}
+
+/*
+ * lat_percentile - Return the value pct percent of the values in h
+ *     are at or below, as the top of its bucket but at most the max
+ */
+uint64_t lat_percentile(const lathist_t *h, double pct)
+{
+    uint64_t rank = (uint64_t)(pct / 100.0 * h->total + 0.999999);
+    uint64_t seen = 0;
+    uint64_t hi;
+    int b;
+
+    if (h->total == 0)
+        return 0;
+    if (rank < 1)
+        rank = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        if ((seen += h->count[b]) >= rank)
+            break;
+    }
+    hi = lat_bucket_hi(b);
+    return hi < h->max ? hi : h->max;
+}
+
+/*
+ * lat_overhead - Return the least time between two back to back
+ *     lat_now() calls, which every measured interval includes
+ */
+uint64_t lat_overhead(void)
+{
+    uint64_t best = UINT64_MAX, t0, t1;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        t0 = lat_now();
+        t1 = lat_now();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    return best;
+}
+
+/*
+ * lat_unit - Return the unit lat_now() counts in. TSC ticks run at a
+ *     fixed rate, not the core clock, so they are not cycles.
+ */
+const char *lat_unit(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return "TSC ticks";
+#else
+    return "ns";
+#endif
+}
@@ -0,0 +1,38 @@
+/*
+ * lathist.h - log-linear latency histograms in the manner of
+ *     HdrHistogram, and a cheap timestamp to feed them
+ */
+#include <stdint.h>
+#include <time.h>
+
+#define LAT_SUB_BITS  5     /* 32 buckets per power of 2, within 3% */
+#define LAT_BUCKETS   ((64 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+typedef struct {
+    uint64_t count[LAT_BUCKETS];
+    uint64_t total;         /* number of values recorded */
+    uint64_t max;           /* largest value recorded */
+} lathist_t;
+
+void lat_record(lathist_t *h, uint64_t value);
+uint64_t lat_percentile(const lathist_t *h, double pct);
+uint64_t lat_overhead(void);
+const char *lat_unit(void);
+
+/* lat_now - Read the time stamp counter, or the monotonic clock in ns
+   where there is none. rdtscp waits for the request before it to
+   finish and the lfence keeps the next one from starting early, as in
+   fmono.c; a plain rdtsc could be reordered into the request. */
+static inline uint64_t lat_now(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi, aux;
+    asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux)
+                 : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
@@ -7,22 +7,34 @@
  * Copyright (c) 2004-2015, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "tracefmt.h"
+#include "lathist.h"
+#include "perfctr.h"
+#include "heapmap.h"
 #include "config.h"
 
 /**********************
@@ -33,10 +45,18 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define FOOT_POINTS   10 /* footprint samples per trace for -F */
+#define LAT_CLASSES    5 /* request size classes of the -L report */
+#define HEAPMAP_TEXT  64 /* heap map columns printed by -m */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* Returns true if p meets the alignment op i of trace asked for */
+#define OP_ALIGNED(trace, i, p) \
+    ((trace)->ops[i].type != ALIGNED || \
+     ((unsigned long)(p)) % (trace)->ops[i].align == 0)
+
 /* weights */
 #define WNONE 0
 #define WALL 1
@@ -54,29 +74,25 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap
+   ordered by lo */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *kid[2];  /* lower and higher ranges */
+    unsigned int prio;     /* no kid has a higher one; a hash of lo */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* header flag from when overlap checks were slow */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    size_t ops_len;      /* bytes mapped for ops, 0 if they were parsed */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
@@ -92,6 +108,28 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* A worker process of a parallel run (-j) */
+typedef struct {
+    pid_t pid;           /* 0 if the slot is free */
+    int fd;              /* read end of the pipe its results come back on */
+    int trace;           /* index of the trace it evaluates */
+} worker_t;
+
+/* Holds the params of one thread of the stress test (-T) */
+typedef struct {
+    trace_t trace;       /* shares ops with the other threads, not blocks */
+    unsigned int seed;   /* rand_r state for the block contents */
+    int checked;         /* check blocks; never set in the timed pass */
+    int done;            /* set if the whole trace was replayed */
+    int oom;             /* set if the heap ran out; not an error here */
+} stress_t;
+
+/* Sums up one latency histogram of the -L report */
+typedef struct {
+    double count;        /* requests timed */
+    double p50, p99, p999, max;     /* percentiles of their latency */
+} latsum_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +143,16 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double foot_peak;    /* most bytes held in heap and mappings */
+    double foot_mean;    /* bytes held, averaged over the ops */
+    double foot_end;     /* bytes held after the last op */
+    double foot_curve[FOOT_POINTS]; /* bytes held at evenly spaced ops */
+    mm_stats_t mm_at_hwm;   /* mm_stats() when the payload peaked */
+    mm_stats_t mm_at_end;   /* mm_stats() after the last op */
+    /* latency of each request type in each size class, and in all of
+       them at [LAT_CLASSES] */
+    latsum_t lat[OP_TYPES][LAT_CLASSES + 1];
+    double perf[PERF_EVENTS];   /* -H event counts of one speed run, or -1 */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -144,6 +192,48 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* by default, no sweep over the heap growth policies */
+static int sweep_flag = 0;
+
+/* by default, no footprint report */
+static int footprint_flag = 0;
+
+/* by default, no allocator statistics report */
+static int mmstats_flag = 0;
+
+/* by default, no multi-threaded stress test */
+static int stress_threads = 0;
+
+/* by default, no latency report */
+static int latency_flag = 0;
+static uint64_t lat_ovhd;       /* timer overhead taken off each request */
+
+/* by default, no hardware event counts */
+static int perf_flag = 0;
+
+/* by default, no heap maps; -m samples the heap every heapmap_every
+   ops of the util pass into heapmap, and -G draws them into svg_dir */
+static long heapmap_every = 0;
+static char *svg_dir = NULL;
+static heapmap_t heapmap;
+
+/* Upper size bounds and names of the latency size classes */
+static const size_t lat_class_max[LAT_CLASSES] = {
+    64, 512, 4096, 128 * 1024, (size_t)-1
+};
+static const char *lat_class_name[LAT_CLASSES + 1] = {
+    "<=64", "<=512", "<=4K", "<=128K", ">128K", "all"
+};
+static const char *op_name[OP_TYPES] = {
+    "malloc", "free", "realloc", "memalign", "batch", "free_sized", "calloc"
+};
+
+/* by default, the traces are evaluated one at a time */
+static int jobs = 1;
+static int serial_timing = 0;   /* workers take turns at the timing runs */
+static int pin_workers = 0;     /* worker k runs on the kth allowed cpu */
+static int timing_lock = -1;    /* file whose lock serializes timing runs */
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -167,11 +257,15 @@ static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_insert(range_t *t, range_t *p);
+static range_t *range_join(range_t *lo, range_t *hi);
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
 static void check_index(const trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
+static void fill_block(trace_t *trace, int index, int base);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
@@ -186,11 +280,34 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static int check_huge(trace_t *trace);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static inline void replay_op(trace_t *trace, int i);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void count_mm_speed(speed_t *speed_params, double count[PERF_EVENTS]);
+static void run_stress(int num_tracefiles, const char *tracedir,
+                       char **tracefiles, int nthreads);
+static int stress_pass(trace_t *trace, stress_t *params, pthread_t *tids,
+                       int nthreads, int checked, double *secs, int *oom);
+static void *eval_mm_stress(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printfootprint(int n, stats_t *stats);
+static void printmmstats(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void report_heapmap(const char *filename);
+static void run_sweep(int num_tracefiles, const char *tracedir,
+                      char **tracefiles, range_t *ranges,
+                      speed_t *speed_params);
+static void run_parallel(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *stats,
+                         range_t *ranges, speed_t *speed_params);
+static size_t read_full(int fd, void *buf, size_t n);
+static void pin_worker(int slot);
+static void lock_timing(int type);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -209,12 +326,21 @@ static void timeout_handler(int sig __attribute__((unused))) {
 }
 
 /* Run the tests; return the number of tests run (may be less than
-   num_tracefiles, if there's a timeout) */
+   num_tracefiles, if there's a timeout). With -j the traces run in
+   worker processes instead. */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles, 
                       stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
     volatile int i;
     volatile int timed_out = 0;
+    double lo, hi;
+    int runs;
+
+    if (jobs > 1 && num_tracefiles > 1 && !onetime_flag) {
+        run_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                     ranges, speed_params);
+        return;
+    }
 
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
@@ -245,12 +371,24 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
+            if (heapmap_every)
+                report_heapmap(trace->filename);
+            if (latency_flag)
+                eval_mm_latency(trace, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
+            lock_timing(F_WRLCK);
             mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (verbose > 1 && (runs = fsecs_interval(&lo, &hi)) > 0)
+                printf("Median of %d runs %.6f secs, "
+                       "95%% interval %.6f to %.6f\n",
+                       runs, mm_stats[i].secs, lo, hi);
+            if (perf_flag)
+                count_mm_speed(speed_params, mm_stats[i].perf);
+            lock_timing(F_UNLCK);
         }
 
         free_trace(trace);
@@ -260,6 +398,199 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_parallel - Do what run_tests does, with each trace in a worker
+ *     process of its own and up to jobs workers at once. A worker maps
+ *     its own memlib heap at the usual address and moves its own brk,
+ *     so workers never share simulated memory. Each sends its stats
+ *     and error count back over a pipe when its trace is done, and is
+ *     reaped only once all of it has been read, so a worker never
+ *     blocks on a full pipe while the parent waits for it to exit.
+ */
+static void run_parallel(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *stats,
+                         range_t *ranges, speed_t *speed_params)
+{
+    worker_t *workers;
+    struct pollfd *pfds;
+    FILE * volatile lockfile = NULL;
+    volatile int next = 0;
+    int i, n, slot, status, fds[2], worker_errors;
+    pid_t pid;
+
+    if ((workers = calloc(jobs, sizeof(worker_t))) == NULL ||
+        (pfds = calloc(jobs, sizeof(struct pollfd))) == NULL)
+        unix_error("run_parallel calloc failed");
+    if (serial_timing) {
+        if ((lockfile = tmpfile()) == NULL)
+            unix_error("tmpfile failed in run_parallel");
+        timing_lock = fileno(lockfile);
+    }
+
+    /* On a timeout, the traces still running or not yet started fail */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        for (slot = 0; slot < jobs; slot++) {
+            if (workers[slot].pid == 0)
+                continue;
+            kill(workers[slot].pid, SIGKILL);
+            waitpid(workers[slot].pid, NULL, 0);
+            close(workers[slot].fd);
+            workers[slot].pid = 0;
+            next = next < workers[slot].trace ? next : workers[slot].trace;
+        }
+        for (i = next; i < num_tracefiles; i++) {
+            if (stats[i].filename[0] != '\0')
+                continue;   /* finished before the timeout */
+            snprintf(stats[i].filename, MAXLINE, "%s%s", tracedir,
+                     tracefiles[i]);
+            stats[i].valid = 0;
+        }
+        next = num_tracefiles;
+    }
+
+    for (;;) {
+        /* Start a worker on the next trace while a slot is free */
+        for (slot = 0; slot < jobs && workers[slot].pid != 0; slot++)
+            ;
+        if (slot < jobs && next < num_tracefiles) {
+            i = next++;
+            if (pipe(fds) < 0)
+                unix_error("pipe failed in run_parallel");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_parallel");
+            if (pid == 0) {
+                close(fds[0]);
+                jobs = 1;
+                if (pin_workers)
+                    pin_worker(slot);
+                run_tests(1, tracedir, &tracefiles[i], &stats[i],
+                          ranges, speed_params);
+                if (write(fds[1], &stats[i], sizeof(stats_t)) !=
+                    sizeof(stats_t) ||
+                    write(fds[1], &errors, sizeof(int)) != sizeof(int))
+                    _exit(1);
+                _exit(0);
+            }
+            close(fds[1]);
+            workers[slot].pid = pid;
+            workers[slot].fd = fds[0];
+            workers[slot].trace = i;
+            continue;
+        }
+
+        /* Wait for a worker to send its results or close its pipe */
+        for (slot = n = 0; slot < jobs; slot++) {
+            pfds[slot].fd = workers[slot].pid != 0 ? workers[slot].fd : -1;
+            pfds[slot].events = POLLIN;
+            n += workers[slot].pid != 0;
+        }
+        if (n == 0)
+            break;          /* every trace is done */
+        if (poll(pfds, jobs, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("poll failed in run_parallel");
+        }
+
+        /* Read all a worker sent before reaping it */
+        for (slot = 0; slot < jobs; slot++) {
+            if (workers[slot].pid == 0 || pfds[slot].revents == 0)
+                continue;
+            i = workers[slot].trace;
+            if (read_full(workers[slot].fd, &stats[i], sizeof(stats_t)) !=
+                sizeof(stats_t) ||
+                read_full(workers[slot].fd, &worker_errors, sizeof(int)) !=
+                sizeof(int))
+                worker_errors = -1;
+            while (waitpid(workers[slot].pid, &status, 0) < 0)
+                if (errno != EINTR)
+                    unix_error("waitpid failed in run_parallel");
+            if (worker_errors < 0) {
+                snprintf(stats[i].filename, MAXLINE, "%s%s", tracedir,
+                         tracefiles[i]);
+                stats[i].valid = 0;
+                worker_errors = 1;
+                printf("ERROR [trace %s]: worker died with status %#x\n",
+                       stats[i].filename, status);
+            }
+            errors += worker_errors;
+            close(workers[slot].fd);
+            workers[slot].pid = 0;
+        }
+    }
+
+    if (lockfile != NULL) {
+        fclose(lockfile);
+        timing_lock = -1;
+    }
+    free(pfds);
+    free(workers);
+}
+
+/*
+ * read_full - Read n bytes from fd into buf, across short reads. Return
+ *     how many were read before end of file or an error.
+ */
+static size_t read_full(int fd, void *buf, size_t n)
+{
+    size_t done = 0;
+    ssize_t got;
+
+    while (done < n) {
+        got = read(fd, (char *)buf + done, n - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += got;
+    }
+    return done;
+}
+
+/*
+ * pin_worker - Keep the calling worker on the cpu in slot slot of the
+ *     set it may run on, so that workers do not migrate while they are
+ *     timed. Restricting mdriver to isolated cores with taskset leaves
+ *     only those in the set.
+ */
+static void pin_worker(int slot)
+{
+    cpu_set_t allowed, one;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+    slot %= CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && slot-- == 0) {
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+/*
+ * lock_timing - Take (F_WRLCK) or drop (F_UNLCK) the lock that lets
+ *     only one worker time its trace at once under -J serial. Record
+ *     locks belong to the process, so a worker that dies drops it.
+ */
+static void lock_timing(int type)
+{
+    struct flock fl;
+
+    if (timing_lock < 0)
+        return;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(timing_lock, F_SETLKW, &fl) < 0) {
+        if (errno != EINTR)
+            unix_error("fcntl failed in lock_timing");
+    }
+}
+
 /**************
  * Main routine
  **************/
@@ -290,7 +621,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:m:G:T:j:J:hVAlDFHLPS")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -348,6 +679,56 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'P': /* Sweep the heap growth policies */
+            sweep_flag = 1;
+            break;
+
+        case 'F': /* Report the heap footprint over time */
+            footprint_flag = 1;
+            break;
+
+        case 'm': /* Sample the heap layout every n ops */
+            heapmap_every = atol(optarg);
+            if (heapmap_every < 1)
+                app_error("-m needs a positive number of ops");
+            break;
+
+        case 'G': /* Draw the heap samples as SVG into a directory */
+            svg_dir = strdup(optarg);
+            break;
+
+        case 'H': /* Count hardware events of the speed runs */
+            perf_flag = 1;
+            break;
+
+        case 'L': /* Report the latency of single requests */
+            latency_flag = 1;
+            break;
+
+        case 'S': /* Report mm_stats() for each trace */
+            mmstats_flag = 1;
+            break;
+
+        case 'j': /* Evaluate this many traces at once, 0 for one per cpu */
+            if ((jobs = atoi(optarg)) <= 0)
+                jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+
+        case 'J': /* Serialize or pin the timing runs of -j workers */
+            if (strcmp(optarg, "serial") == 0)
+                serial_timing = 1;
+            else if (strcmp(optarg, "pin") == 0)
+                pin_workers = 1;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+
+        case 'T': /* Replay each trace in this many threads at once */
+            stress_threads = atoi(optarg);
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -370,6 +751,19 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (latency_flag)
+        lat_ovhd = lat_overhead();
+    if (svg_dir != NULL && heapmap_every == 0)
+        app_error("-G draws the samples of -m, which is missing");
+    if (perf_flag) {
+        perfctr_t pc;
+        if (perf_open(&pc) == 0) {
+            fprintf(stderr, "Hardware counters unavailable (%s), "
+                    "ignoring -H\n", strerror(pc.err));
+            perf_flag = 0;
+        }
+        perf_close(&pc);
+    }
 
     /* Initialize the timeout */
     if (set_timeout > 0) {
@@ -413,6 +807,15 @@ int main(int argc, char **argv)
         }
     }
 
+    /*
+     * Optionally run every growth policy instead, and compare them
+     */
+    if (sweep_flag) {
+        run_sweep(num_tracefiles, tracedir, tracefiles, ranges,
+                  &speed_params);
+        exit(0);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
@@ -441,9 +844,22 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (footprint_flag)
+                printfootprint(num_tracefiles, mm_stats);
+            if (mmstats_flag)
+                printmmstats(num_tracefiles, mm_stats);
+            if (latency_flag)
+                printlatency(num_tracefiles, mm_stats);
+            if (perf_flag)
+                printperf(num_tracefiles, mm_stats);
         }
     }
 
+    /* Optionally stress mm with several threads per trace */
+    if (stress_threads > 0 && !onetime_flag) {
+        run_stress(num_tracefiles, tracedir, tracefiles, stress_threads);
+    }
+
     /* Optionally compare the performance of mm and libc */
     if (run_libc) {
         printf("Comparison with libc malloc: mm/libc = %.0f Kops / %.0f Kops = %.2f\n", 
@@ -569,22 +985,26 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range treap, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range treap to detect any overlapping allocated blocks. Payloads
+ * in it never overlap, so the one with the highest lo at or below
+ * a new payload's hi is the only one that can overlap it, and each
+ * check, insert and remove takes expected O(log n).
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the treap.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    range_t *t;
 
     assert(size > 0);
 
@@ -595,61 +1015,99 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_mapped(lo, size)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
+                     "Payload (%p:%p) lies outside heap (%p:%p) and mappings",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
-
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
-        }
+    /* The payload must not overlap any other payloads. The treap makes
+       this cheap enough to check in every mode, debugging or not. */
+    for (p = NULL, t = *ranges;  t != NULL;  t = t->kid[t->lo <= hi]) {
+        if (t->lo <= hi)
+            p = t;
+    }
+    if (p != NULL && p->hi >= lo) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, p->lo, p->hi);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range treap.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->kid[0] = p->kid[1] = NULL;
+    p->prio = (unsigned int)(((size_t)lo * 0x9e3779b97f4a7c15ULL) >> 32);
     p->index = index;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
 
     return 1;
 }
 
+/*
+ * range_insert - Insert range p into the treap at t, rotating it up
+ *     past ranges of lower priority. Return the new root.
+ */
+static range_t *range_insert(range_t *t, range_t *p)
+{
+    range_t *c;
+    int dir;
+
+    if (t == NULL)
+        return p;
+
+    dir = p->lo > t->lo;
+    t->kid[dir] = c = range_insert(t->kid[dir], p);
+    if (c->prio > t->prio) {
+        t->kid[dir] = c->kid[!dir];
+        c->kid[!dir] = t;
+        return c;
+    }
+    return t;
+}
+
+/*
+ * range_join - Join treaps lo and hi, where every range in lo lies
+ *     below every range in hi. Return the new root.
+ */
+static range_t *range_join(range_t *lo, range_t *hi)
+{
+    if (lo == NULL)
+        return hi;
+    if (hi == NULL)
+        return lo;
+
+    if (lo->prio > hi->prio) {
+        lo->kid[1] = range_join(lo->kid[1], hi);
+        return lo;
+    }
+    hi->kid[0] = range_join(lo, hi->kid[0]);
+    return hi;
+}
+
 /*
  * remove_range - Free the range record of block whose payload starts at lo
  */
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+        ranges = &p->kid[lo > p->lo];
+
+    if (p != NULL) {
+        *ranges = range_join(p->kid[0], p->kid[1]);
+        free(p);
     }
 }
 
@@ -658,16 +1116,27 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+    if (p != NULL) {
+        clear_ranges(&p->kid[0]);
+        clear_ranges(&p->kid[1]);
         free(p);
     }
     *ranges = NULL;
 }
 
+/*
+ * check_ranges - check_index every block in the treap at r
+ */
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r)
+{
+    for (; r != NULL; r = r->kid[1]) {
+        check_ranges(trace, opnum, r->kid[0]);
+        check_index(trace, opnum, r->index);
+    }
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
@@ -684,18 +1153,20 @@ static void init_random_data(void) {
 }
 
 static void randomize_block(trace_t *traces, int index) {
+    if(debug_mode == DBG_NONE) return;
+
+    fill_block(traces, index, random());
+}
+
+static void fill_block(trace_t *traces, int index, int base) {
     size_t size;
     size_t i;
     randint_t *block;
-    int base;
-
-    if(debug_mode == DBG_NONE) return;
 
-    traces->block_rand_base[index] = random();
+    traces->block_rand_base[index] = base;
 
     block = (randint_t*)traces->blocks[index];
     size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
 
     for(i = 0; i < size; i++) {
         block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
@@ -735,17 +1206,14 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary
+ *     sidecar of the trace is mapped instead when one is up to date.
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
+    tracehdr_t hdr;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -754,79 +1222,32 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* Read the trace file, or map its sidecar */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL) {
-        unix_error("Could not open %s in read_trace", trace->filename);
+    if ((trace->ops = trace_load(trace->filename, &hdr,
+                                 &trace->ops_len)) == NULL) {
+        app_error("Could not read %s in read_trace\n", trace->filename);
     }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
-
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
-    }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    trace->weight = hdr.weight;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->ignore_ranges = hdr.ignore_ranges;
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
          (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
+        unix_error("malloc 2 failed in read_trace");
 
     /* ... along with the corresponding byte sizes of each block */
     if ((trace->block_sizes =
          (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
+        unix_error("malloc 3 failed in read_trace");
 
     /* and, if we're debugging, the offset into the random data */
     if ((trace->block_rand_base =
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
-
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
-        }
-        op_index++;
-        if(op_index == trace->num_ops) break;
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+        unix_error("malloc 4 failed in read_trace");
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -848,11 +1269,14 @@ static void reinit_trace(trace_t *trace)
 
 /*
  * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated or mapped in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->ops_len)       /* free the four arrays... */
+        trace_unmap(trace->ops, trace->ops_len);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
@@ -869,7 +1293,7 @@ static void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
+    int i, k;
     int index;
     size_t size;
     char *newp;
@@ -893,28 +1317,36 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         size = trace->ops[i].size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-                        
             /* Let the students check their own heap */
             mm_checkheap(i+1);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case ALIGNED: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].type == ALIGNED) {
+                p = mm_memalign(trace->ops[i].align, size);
+            } else if (trace->ops[i].type == CALLOC) {
+                p = mm_calloc(1, size);
+            } else {
+                p = mm_malloc(size);
+            }
+            if (p == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
+            if (!OP_ALIGNED(trace, i, p)) {
+                malloc_error(trace, i, "Payload address (%p) not aligned to %u bytes",
+                             p, trace->ops[i].align);
+                return 0;
+            }
 
             /*
              * Test the range of the new block for correctness and add it
@@ -924,6 +1356,17 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             if (add_range(ranges, p, size, trace, i, index) == 0)
                 return 0;
 
+            /* A calloc'd block must read as zero */
+            if (trace->ops[i].type == CALLOC) {
+                for (k = 0; k < (int)size; k++) {
+                    if (p[k] != 0) {
+                        malloc_error(trace, i, "mm_calloc byte %d of %p is not zero",
+                                     k, p);
+                        return 0;
+                    }
+                }
+            }
+
             /* Remember region */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
@@ -972,7 +1415,25 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             randomize_block(trace, index);
             break;
 
+        case BATCH: /* mm_malloc_batch */
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+
+            /* Each block of the batch is checked like a single one */
+            for (k = index; k < index + trace->ops[i].count; k++) {
+                if (add_range(ranges, trace->blocks[k], size, trace, i, k) == 0)
+                    return 0;
+                trace->block_sizes[k] = size;
+                randomize_block(trace, k);
+            }
+            break;
+
         case FREE: /* mm_free */
+        case SFREE: /* mm_free_sized */
             check_index(trace, i, index);
 
             /* Remove region from list and call student's free function */
@@ -982,7 +1443,10 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            if (trace->ops[i].type == SFREE)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
             break;
 
         default:
@@ -991,29 +1455,304 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
 
     }
 
+    if (!check_huge(trace))
+        return 0;
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
+/*
+ * check_huge - Check that requests no heap can hold fail with NULL
+ *     instead of wrapping around to a small block
+ */
+static int check_huge(trace_t *trace)
+{
+    static const size_t sizes[] = { SIZE_MAX, SIZE_MAX - 2, SIZE_MAX / 2 + 1 };
+    char *p, *newp;
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if ((p = mm_malloc(sizes[i])) != NULL) {
+            malloc_error(trace, -1,
+                         "mm_malloc(%zu) returned %p", sizes[i], p);
+            return 0;
+        }
+        if ((p = mm_calloc(1, sizes[i])) != NULL) {
+            malloc_error(trace, -1,
+                         "mm_calloc(1, %zu) returned %p", sizes[i], p);
+            return 0;
+        }
+    }
+    if ((p = mm_calloc(SIZE_MAX / 2 + 1, 2)) != NULL) {
+        malloc_error(trace, -1,
+                     "mm_calloc(%zu, 2) returned %p", SIZE_MAX / 2 + 1, p);
+        return 0;
+    }
+
+    /* A failed realloc leaves the old block alone */
+    if ((p = mm_malloc(64)) == NULL) {
+        malloc_error(trace, -1, "mm_malloc failed.");
+        return 0;
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if ((newp = mm_realloc(p, sizes[i])) != NULL) {
+            malloc_error(trace, -1,
+                         "mm_realloc(%p, %zu) returned %p", p, sizes[i], newp);
+            return 0;
+        }
+    }
+    mm_free(p);
+    return 1;
+}
+
+/*
+ * run_stress - Replay each trace in nthreads threads at once against
+ *     one heap, and print the aggregate throughput. Every thread keeps
+ *     its own blocks; the random data in them catches blocks that are
+ *     handed to two threads, which the range list cannot see. With
+ *     debugging on, a checked pass runs first, and the timed pass
+ *     after it runs without checks, so the checker is not timed.
+ */
+static void run_stress(int num_tracefiles, const char *tracedir,
+                       char **tracefiles, int nthreads)
+{
+    int i;
+    stats_t stats;
+    stress_t *params;
+    pthread_t *tids;
+
+    if ((params = calloc(nthreads, sizeof(stress_t))) == NULL ||
+        (tids = calloc(nthreads, sizeof(pthread_t))) == NULL)
+        unix_error("run_stress calloc failed");
+
+    printf("Results for mm malloc, %d threads per trace:\n", nthreads);
+    printf("  %2s%8s%10s%6s  %s\n", "valid", "ops", "secs", "Kops", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+        int valid = 1;
+        int oom = 0;
+        double secs = 0;
+
+        if (debug_mode != DBG_NONE)
+            valid = stress_pass(trace, params, tids, nthreads, 1, &secs, &oom);
+        if (valid)
+            valid = stress_pass(trace, params, tids, nthreads, 0, &secs, &oom);
+
+        if (valid) {
+            printf("%2s%4s%8.0f%10.6f%6.0f %s\n", "", "yes",
+                   (double)trace->num_ops * nthreads, secs,
+                   trace->num_ops * nthreads / 1e3 / secs, trace->filename);
+        } else {
+            printf("%2s%4s%8s%10s%6s %s\n", "", oom ? "oom" : "no",
+                   "-", "-", "-", trace->filename);
+        }
+        free_trace(trace);
+    }
+    printf("\n");
+
+    free(params);
+    free(tids);
+}
+
+/*
+ * stress_pass - Replay trace in nthreads threads on a fresh heap, with
+ *     the blocks checked if checked is set. Return whether every thread
+ *     got through it, and set *secs to the time taken and *oom if the
+ *     heap ran out.
+ */
+static int stress_pass(trace_t *trace, stress_t *params, pthread_t *tids,
+                       int nthreads, int checked, double *secs, int *oom)
+{
+    struct timeval start, end;
+    int t, valid = 1;
+
+    mem_init();
+    if (mm_init() < 0) {
+        malloc_error(trace, 0, "mm_init failed.");
+        mem_deinit();
+        return 0;
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        params[t].trace = *trace;
+        params[t].seed = t + 1;
+        params[t].checked = checked;
+        params[t].done = 0;
+        params[t].oom = 0;
+        params[t].trace.blocks = calloc(trace->num_ids, sizeof(char *));
+        params[t].trace.block_sizes = calloc(trace->num_ids, sizeof(size_t));
+        params[t].trace.block_rand_base = calloc(trace->num_ids, sizeof(int));
+        if (params[t].trace.blocks == NULL ||
+            params[t].trace.block_sizes == NULL ||
+            params[t].trace.block_rand_base == NULL)
+            unix_error("run_stress calloc failed");
+    }
+
+    gettimeofday(&start, NULL);
+    for (t = 0; t < nthreads; t++) {
+        if (pthread_create(&tids[t], NULL, eval_mm_stress, &params[t]))
+            unix_error("pthread_create failed");
+    }
+    for (t = 0; t < nthreads; t++) {
+        pthread_join(tids[t], NULL);
+        valid &= params[t].done;
+        *oom |= params[t].oom;
+    }
+    gettimeofday(&end, NULL);
+    *secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    if (checked && debug_mode == DBG_EXPENSIVE)
+        mm_checkheap(0);
+
+    for (t = 0; t < nthreads; t++) {
+        free(params[t].trace.blocks);
+        free(params[t].trace.block_sizes);
+        free(params[t].trace.block_rand_base);
+        params[t].trace.blocks = NULL;
+        params[t].trace.block_sizes = NULL;
+        params[t].trace.block_rand_base = NULL;
+    }
+    mem_deinit();
+    return valid;
+}
+
+/*
+ * eval_mm_stress - Replay a trace as one of several threads. In a
+ *     checked pass blocks are checked for alignment and heap bounds, and
+ *     their random data is checked on realloc and free.
+ */
+static void *eval_mm_stress(void *ptr)
+{
+    stress_t *st = (stress_t *)ptr;
+    trace_t *trace = &st->trace;
+    int i, k;
+    int index;
+    size_t size;
+    char *p;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case ALIGNED: /* mm_memalign */
+        case REALLOC: /* mm_realloc */
+            if (trace->ops[i].type == ALLOC) {
+                p = mm_malloc(size);
+            } else if (trace->ops[i].type == CALLOC) {
+                p = mm_calloc(1, size);
+            } else if (trace->ops[i].type == ALIGNED) {
+                p = mm_memalign(trace->ops[i].align, size);
+            } else {
+                if (st->checked)
+                    check_index(trace, i, index);
+                p = mm_realloc(trace->blocks[index], size);
+            }
+            if (p == NULL) {
+                if (size == 0) {
+                    trace->blocks[index] = NULL;
+                    trace->block_sizes[index] = 0;
+                    break;
+                }
+                /* n copies of a trace need not fit in MAX_HEAP */
+                st->oom = 1;
+                return NULL;
+            }
+            trace->blocks[index] = p;
+            if (!st->checked) {
+                trace->block_sizes[index] = size;
+                break;
+            }
+
+            if (!IS_ALIGNED(p) || !OP_ALIGNED(trace, i, p)) {
+                malloc_error(trace, i, "Payload address (%p) not aligned to %u bytes",
+                             p, trace->ops[i].type == ALIGNED ?
+                             trace->ops[i].align : ALIGNMENT);
+                return NULL;
+            }
+            if (((void *)p < mem_heap_lo() ||
+                 (void *)(p + size) > mem_heap_hi() + 1) &&
+                !mem_mapped(p, size)) {
+                malloc_error(trace, i, "Payload (%p:%p) lies outside heap (%p:%p)",
+                             p, p + size, mem_heap_lo(), mem_heap_hi());
+                return NULL;
+            }
+
+            /* Check up to min(size, oldsize) for correct copying */
+            if (trace->ops[i].type == REALLOC) {
+                if (size < trace->block_sizes[index])
+                    trace->block_sizes[index] = size;
+                check_index(trace, i, index);
+            }
+            trace->block_sizes[index] = size;
+            fill_block(trace, index, rand_r(&st->seed));
+            break;
+
+        case BATCH: /* mm_malloc_batch */
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count) {
+                st->oom = 1;
+                return NULL;
+            }
+            for (k = index; k < index + trace->ops[i].count; k++) {
+                trace->block_sizes[k] = size;
+                if (!st->checked)
+                    continue;
+                if (!IS_ALIGNED(trace->blocks[k])) {
+                    malloc_error(trace, i, "Payload address (%p) not aligned to %d bytes",
+                                 trace->blocks[k], ALIGNMENT);
+                    return NULL;
+                }
+                fill_block(trace, k, rand_r(&st->seed));
+            }
+            break;
+
+        case FREE: /* mm_free */
+        case SFREE: /* mm_free_sized */
+            if (st->checked)
+                check_index(trace, i, index);
+            if (index == -1)
+                mm_free(NULL);
+            else if (trace->ops[i].type == SFREE)
+                mm_free_sized(trace->blocks[index], size);
+            else
+                mm_free(trace->blocks[index]);
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_stress");
+        }
+    }
+
+    st->done = 1;
+    return NULL;
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   Utilization is the ratio hwm/peak, where peak is the most memory
+ *   the student's malloc package held at once on the trace, counting
+ *   both the heap and the pages it got from mem_map(). The footprint
+ *   over the trace is recorded in stats for the -F report, and
+ *   mm_stats() at the hwm and at the end for the -S report.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
+    int i, k;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    double foot_sum = 0;
     char *p;
     char *newp, *oldp;
 
@@ -1028,10 +1767,18 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case ALIGNED: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].type == ALIGNED)
+                p = mm_memalign(trace->ops[i].align, size);
+            else if (trace->ops[i].type == CALLOC)
+                p = mm_calloc(1, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1061,7 +1808,24 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size += (newsize - oldsize);
             break;
 
+        case BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (k = index; k < index + trace->ops[i].count; k++)
+                trace->block_sizes[k] = size;
+
+            total_size += size * trace->ops[i].count;
+            break;
+
         case FREE: /* mm_free */
+        case SFREE: /* mm_free_sized */
             index = trace->ops[i].index;
             if(index < 0) {
                 size = 0;
@@ -1071,7 +1835,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            if (trace->ops[i].type == SFREE)
+                mm_free_sized(p, trace->ops[i].size);
+            else
+                mm_free(p);
 
             total_size -= size;
             break;
@@ -1082,13 +1849,31 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         }
 
         /* update the high-water mark */
-        max_total_size = (total_size > max_total_size) ?
-            total_size : max_total_size;
+        if (total_size > max_total_size) {
+            max_total_size = total_size;
+            if (mmstats_flag)
+                mm_stats(&stats->mm_at_hwm);
+        }
+
+        if (heapmap_every &&
+            ((i + 1) % heapmap_every == 0 || i + 1 == trace->num_ops))
+            heapmap_sample(&heapmap, i + 1);
+
+        /* sample the footprint, the last op of each stretch wins */
+        foot_sum += mem_footprint();
+        stats->foot_curve[(long)i * FOOT_POINTS / trace->num_ops] =
+            mem_footprint();
     }
 
+    stats->foot_peak = mem_peaksize();
+    stats->foot_mean = trace->num_ops ? foot_sum / trace->num_ops : 0;
+    stats->foot_end = mem_footprint();
+    if (mmstats_flag)
+        mm_stats(&stats->mm_at_end);
+
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -1098,8 +1883,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
@@ -1110,38 +1894,154 @@ static void eval_mm_speed(void *ptr)
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+        replay_op(trace, i);
+}
 
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-                app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+/*
+ * replay_op - Run request i of trace against mm, for the timed runs.
+ *    Inlined into the loops that time it.
+ */
+static inline void replay_op(trace_t *trace, int i)
+{
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
 
-        case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
-                app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+    switch (trace->ops[i].type) {
+    case ALLOC: /* mm_malloc */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_malloc(size)) == NULL)
+            app_error("mm_malloc error in eval_mm_speed");
+        trace->blocks[index] = p;
+        break;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            if(index < 0) {
-                block = 0;
-            } else {
-                block = trace->blocks[index];
-            }
-            mm_free(block);
-            break;
+    case ALIGNED: /* mm_memalign */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+            app_error("mm_memalign error in eval_mm_speed");
+        trace->blocks[index] = p;
+        break;
 
-        default:
-            app_error("Nonexistent request type in eval_mm_speed");
+    case CALLOC: /* mm_calloc */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_calloc(1, size)) == NULL)
+            app_error("mm_calloc error in eval_mm_speed");
+        trace->blocks[index] = p;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        index = trace->ops[i].index;
+        newsize = trace->ops[i].size;
+        oldp = trace->blocks[index];
+        if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            app_error("mm_realloc error in eval_mm_speed");
+        trace->blocks[index] = newp;
+        break;
+
+    case BATCH: /* mm_malloc_batch */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if (mm_malloc_batch(size, trace->ops[i].count,
+                            (void **)&trace->blocks[index]) !=
+            (size_t)trace->ops[i].count)
+            app_error("mm_malloc_batch error in eval_mm_speed");
+        break;
+
+    case SFREE: /* mm_free_sized */
+        index = trace->ops[i].index;
+        mm_free_sized(index < 0 ? NULL : trace->blocks[index],
+                      trace->ops[i].size);
+        break;
+
+    case FREE: /* mm_free */
+        index = trace->ops[i].index;
+        if(index < 0) {
+            block = 0;
+        } else {
+            block = trace->blocks[index];
         }
+        mm_free(block);
+        break;
+
+    default:
+        app_error("Nonexistent request type in eval_mm_speed");
+    }
+}
+
+/*
+ * count_mm_speed - Run eval_mm_speed once more with the hardware
+ *    counters on, and read their counts into count
+ */
+static void count_mm_speed(speed_t *speed_params, double count[PERF_EVENTS])
+{
+    perfctr_t pc;
+
+    perf_open(&pc);
+    perf_start(&pc);
+    eval_mm_speed(speed_params);
+    perf_stop(&pc, count);
+    perf_close(&pc);
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, timing each request on
+ *    its own with lat_now(), and sum up the latency histograms of each
+ *    request type and size class in stats. A free counts in the size
+ *    class of the block it frees.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    lathist_t *hist;
+    uint64_t t0, t1, ticks;
+    size_t size;
+    int i, k, type, cls;
+
+    if ((hist = calloc(OP_TYPES * (LAT_CLASSES + 1), sizeof(lathist_t))) == NULL)
+        unix_error("calloc failed in eval_mm_latency");
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        type = trace->ops[i].type;
+        if (type == FREE || type == SFREE)
+            size = trace->ops[i].index < 0 ? 0 :
+                   trace->block_sizes[trace->ops[i].index];
+        else
+            size = trace->ops[i].size;
+
+        t0 = lat_now();
+        replay_op(trace, i);
+        t1 = lat_now();
+
+        /* replay_op does not keep the sizes the frees are classed by */
+        if (type == BATCH) {
+            for (k = 0; k < trace->ops[i].count; k++)
+                trace->block_sizes[trace->ops[i].index + k] = size;
+        } else if (type != FREE && type != SFREE) {
+            trace->block_sizes[trace->ops[i].index] = size;
+        }
+
+        ticks = t1 - t0 > lat_ovhd ? t1 - t0 - lat_ovhd : 0;
+        for (cls = 0; size > lat_class_max[cls]; cls++)
+            ;
+        lat_record(&hist[type * (LAT_CLASSES + 1) + cls], ticks);
+        lat_record(&hist[type * (LAT_CLASSES + 1) + LAT_CLASSES], ticks);
+    }
+
+    for (i = 0; i < OP_TYPES * (LAT_CLASSES + 1); i++) {
+        latsum_t *sum = &stats->lat[i / (LAT_CLASSES + 1)][i % (LAT_CLASSES + 1)];
+        sum->count = hist[i].total;
+        sum->p50 = lat_percentile(&hist[i], 50);
+        sum->p99 = lat_percentile(&hist[i], 99);
+        sum->p999 = lat_percentile(&hist[i], 99.9);
+        sum->max = hist[i].max;
+    }
+    free(hist);
 }
 
 /*
@@ -1152,7 +2052,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    int i, k, newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1168,6 +2068,23 @@ static int eval_libc_valid(trace_t *trace)
             trace->blocks[trace->ops[i].index] = p;
             break;
 
+        case CALLOC: /* calloc */
+            if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+                malloc_error(trace, i, "libc calloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
+        case ALIGNED: /* posix_memalign */
+            if (posix_memalign((void **)&p, trace->ops[i].align,
+                               trace->ops[i].size) != 0) {
+                malloc_error(trace, i, "libc posix_memalign failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
             oldp = trace->blocks[trace->ops[i].index];
@@ -1178,7 +2095,18 @@ static int eval_libc_valid(trace_t *trace)
             trace->blocks[trace->ops[i].index] = newp;
             break;
 
+        case BATCH: /* one malloc per block */
+            for (k = 0; k < trace->ops[i].count; k++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + k] = p;
+            }
+            break;
+
         case FREE: /* free */
+        case SFREE:
             if(trace->ops[i].index >= 0) {
                 free(trace->blocks[trace->ops[i].index]);
             } else {
@@ -1201,7 +2129,7 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, k;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1218,6 +2146,22 @@ static void eval_libc_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case CALLOC: /* calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = calloc(1, size)) == NULL)
+                unix_error("calloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case ALIGNED: /* posix_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+                unix_error("posix_memalign failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1228,7 +2172,18 @@ static void eval_libc_speed(void *ptr)
             trace->blocks[index] = newp;
             break;
 
+        case BATCH: /* one malloc per block */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            for (k = 0; k < trace->ops[i].count; k++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + k] = p;
+            }
+            break;
+
         case FREE: /* free */
+        case SFREE:
             index = trace->ops[i].index;
             if(index >= 0) {
                 block = trace->blocks[index];
@@ -1372,6 +2327,242 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * run_sweep - Run the traces under every heap growth policy of mm and
+ *     print each policy's average utilization and throughput, weighted
+ *     as for the performance index. A policy is on the Pareto front if
+ *     no other policy is at least as good on both and better on one.
+ */
+static void run_sweep(int num_tracefiles, const char *tracedir,
+                      char **tracefiles, range_t *ranges,
+                      speed_t *speed_params)
+{
+    int npolicies, p, q, i;
+    double *util, *tput;
+    stats_t *stats;
+
+    for (npolicies = 0; mm_growth_name(npolicies) != NULL; npolicies++)
+        ;
+    util = calloc(npolicies, sizeof(double));
+    tput = calloc(npolicies, sizeof(double));
+    stats = calloc(num_tracefiles, sizeof(stats_t));
+    if (util == NULL || tput == NULL || stats == NULL)
+        unix_error("run_sweep calloc failed");
+
+    for (p = 0; p < npolicies; p++) {
+        double sumutil = 0, sumops = 0, sumsecs = 0;
+        int util_weight = 0;
+
+        if (verbose > 1)
+            printf("\nTesting growth policy %s\n", mm_growth_name(p));
+        mm_set_growth(p);
+        memset(stats, 0, num_tracefiles * sizeof(stats_t));
+        run_tests(num_tracefiles, tracedir, tracefiles, stats,
+                  ranges, speed_params);
+
+        for (i = 0; i < num_tracefiles; i++) {
+            if (stats[i].weight == WALL || stats[i].weight == WPERF) {
+                sumsecs += stats[i].secs;
+                sumops += stats[i].ops;
+            }
+            if (stats[i].weight == WALL || stats[i].weight == WUTIL) {
+                sumutil += stats[i].util;
+                util_weight++;
+            }
+        }
+        util[p] = util_weight ? sumutil / util_weight : 0;
+        tput[p] = sumsecs ? sumops / 1e3 / sumsecs : 0;
+    }
+    mm_set_growth(0);
+
+    printf("\nHeap growth policies (* on the Pareto front):\n");
+    printf("  %-12s%6s%8s\n", "policy", "util", "Kops");
+    for (p = 0; p < npolicies; p++) {
+        int dominated = 0;
+        for (q = 0; q < npolicies; q++) {
+            if (util[q] >= util[p] && tput[q] >= tput[p] &&
+                (util[q] > util[p] || tput[q] > tput[p]))
+                dominated = 1;
+        }
+        printf("%c %-12s%5.1f%%%8.0f\n", dominated ? ' ' : '*',
+               mm_growth_name(p), util[p] * 100.0, tput[p]);
+    }
+    if (errors)
+        printf("Terminated with %d errors\n", errors);
+
+    free(util);
+    free(tput);
+    free(stats);
+}
+
+/*
+ * printfootprint - Print how much memory mm held over each trace:
+ *     peak, mean and final footprint in KB, then the footprint at
+ *     FOOT_POINTS evenly spaced ops as a percentage of the peak.
+ */
+static void printfootprint(int n, stats_t *stats)
+{
+    int i, j;
+
+    printf("Heap footprint (KB), and %% of peak over the trace:\n");
+    printf("%8s%8s%8s  %-*s  %s\n", "peak", "mean", "end",
+           4 * FOOT_POINTS - 1, "timeline", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].foot_peak == 0)
+            continue;
+        printf("%8.0f%8.0f%8.0f ", stats[i].foot_peak / 1024,
+               stats[i].foot_mean / 1024, stats[i].foot_end / 1024);
+        for (j = 0; j < FOOT_POINTS; j++)
+            printf("%4.0f", 100.0 * stats[i].foot_curve[j] / stats[i].foot_peak);
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("\n");
+}
+
+/*
+ * printmmstats - Print what mm_stats() reported for each trace: the
+ *     heap, its free bytes and largest free block in KB when the
+ *     payload peaked, and how much of the free memory lies outside
+ *     that largest block; then the heap peak and the sbrk and mapping
+ *     calls over the whole trace. -V adds the free blocks per class.
+ */
+static void printmmstats(int n, stats_t *stats)
+{
+    int i, j;
+    size_t blocks;
+
+    printf("Allocator statistics (KB) at the payload peak, "
+           "and calls over the trace:\n");
+    printf("%8s%8s%8s%6s%8s%8s%7s%6s  %s\n", "heap", "free", "largest",
+           "frag", "blocks", "peak", "sbrk", "maps", "trace");
+    for (i = 0; i < n; i++) {
+        mm_stats_t *hwm = &stats[i].mm_at_hwm;
+        mm_stats_t *end = &stats[i].mm_at_end;
+        if (!stats[i].valid)
+            continue;
+        for (blocks = 0, j = 0; j < MM_STAT_CLASSES; j++)
+            blocks += hwm->free_count[j];
+        printf("%8.0f%8.0f%8.0f%5.0f%%%8zu%8.0f%7zu%6zu  %s\n",
+               hwm->heap_size / 1024.0, hwm->free_total / 1024.0,
+               hwm->free_largest / 1024.0,
+               hwm->free_total ?
+               100.0 * (hwm->free_total - hwm->free_largest) / hwm->free_total : 0,
+               blocks, end->heap_peak / 1024.0, end->sbrk_calls,
+               end->map_calls, stats[i].filename);
+        if (verbose > 1) {
+            printf("        free blocks per class:");
+            for (j = 0; j < MM_STAT_CLASSES; j++)
+                printf(" %zu", hwm->free_count[j]);
+            printf("\n");
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * printperf - Print the hardware events of each trace per request,
+ *     next to its throughput. Events with no counter print as --.
+ */
+static void printperf(int n, stats_t *stats)
+{
+    static const char *title[PERF_EVENTS] = {
+        "cycles", "instrs", "L1d-miss", "LLC-miss", "br-miss", "dTLB-miss"
+    };
+    int i, j;
+
+    printf("Hardware events per request:\n");
+    printf("%8s", "Kops");
+    for (j = 0; j < PERF_EVENTS; j++) {
+        printf("%10s", title[j]);
+        if (j == PERF_INSTRUCTIONS)
+            printf("%6s", "IPC");
+    }
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        double *perf = stats[i].perf;
+        if (!stats[i].valid)
+            continue;
+        printf("%8.0f", stats[i].secs > 0 ? stats[i].ops / stats[i].secs / 1e3 : 0);
+        for (j = 0; j < PERF_EVENTS; j++) {
+            if (perf[j] < 0)
+                printf("%10s", "--");
+            else
+                printf("%10.2f", perf[j] / stats[i].ops);
+            if (j == PERF_INSTRUCTIONS) {
+                if (perf[PERF_CYCLES] > 0 && perf[PERF_INSTRUCTIONS] >= 0)
+                    printf("%6.2f", perf[PERF_INSTRUCTIONS] / perf[PERF_CYCLES]);
+                else
+                    printf("%6s", "--");
+            }
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("\n");
+}
+
+/*
+ * report_heapmap - Print the heap samples the util pass took of a
+ *     trace, and draw them to an SVG file named after it with -G. The
+ *     text is written in one piece, so -j workers do not mix theirs.
+ */
+static void report_heapmap(const char *filename)
+{
+    char path[MAXLINE];
+    const char *base;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    if ((fp = open_memstream(&buf, &len)) == NULL)
+        unix_error("open_memstream failed in report_heapmap");
+    fprintf(fp, "\nHeap map of %s, every %ld ops:\n", filename, heapmap_every);
+    heapmap_print(fp, &heapmap, HEAPMAP_TEXT);
+    if (svg_dir != NULL) {
+        base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+        snprintf(path, sizeof(path), "%s/%s.svg", svg_dir, base);
+        if (heapmap_svg(path, &heapmap, base) < 0)
+            fprintf(fp, "  cannot write %s: %s\n", path, strerror(errno));
+        else
+            fprintf(fp, "  drawn to %s\n", path);
+    }
+    fclose(fp);
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    free(buf);
+    heapmap_free(&heapmap);
+}
+
+/*
+ * printlatency - Print p50, p99, p99.9 and max latency of each request
+ *     type on each trace, less the timer overhead. -V breaks them down
+ *     by request size.
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, type, cls;
+
+    printf("Request latency (%s, less %llu of timer overhead):\n",
+           lat_unit(), (unsigned long long)lat_ovhd);
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %s\n", stats[i].filename);
+        printf("  %-11s%7s%9s%8s%8s%8s%10s\n", "request", "size",
+               "count", "p50", "p99", "p99.9", "max");
+        for (type = 0; type < OP_TYPES; type++) {
+            for (cls = 0; cls <= LAT_CLASSES; cls++) {
+                latsum_t *sum = &stats[i].lat[type][cls];
+                if (sum->count == 0 || (cls < LAT_CLASSES && verbose < 2))
+                    continue;
+                printf("  %-11s%7s%9.0f%8.0f%8.0f%8.0f%10.0f\n",
+                       op_name[type], lat_class_name[cls], sum->count,
+                       sum->p50, sum->p99, sum->p999, sum->max);
+            }
+        }
+    }
+    printf("\n");
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1396,7 +2587,8 @@ void unix_error(const char *fmt, ...) {
 }
 
 /*
- * malloc_error - Report an error returned by the mm_malloc package
+ * malloc_error - Report an error returned by the mm_malloc package.
+ *     An opnum of -1 is a request the driver made up, on no trace line.
  */
 void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
 {
@@ -1405,7 +2597,10 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
 
     errors++;
 
-    printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
+    if (opnum < 0)
+        printf("ERROR [trace %s, after the trace]: ", trace->filename);
+    else
+        printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
     vprintf(fmt, ap);
     putchar('\n');
 
@@ -1428,5 +2623,16 @@ static void usage(void)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-P         Compare the heap growth policies of mm.\n");
+    fprintf(stderr, "\t-F         Report the heap footprint over each trace.\n");
+    fprintf(stderr, "\t-m <n>     Sample the heap every n ops and print a fragmentation timeline.\n");
+    fprintf(stderr, "\t-G <dir>   Also draw the -m samples of each trace as <dir>/<trace>.svg.\n");
+    fprintf(stderr, "\t-H         Count hardware events such as cache misses per request.\n");
+    fprintf(stderr, "\t-L         Report latency percentiles of single requests.\n");
+    fprintf(stderr, "\t-S         Report mm's allocator statistics for each trace.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate n traces at once in worker processes (0: one per cpu).\n");
+    fprintf(stderr, "\t-J serial  Let one -j worker at a time run its timing runs.\n");
+    fprintf(stderr, "\t-J pin     Keep each -j worker on a cpu of its own.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace in n threads at once.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 }
@@ -16,10 +16,23 @@
 #include "memlib.h"
 #include "config.h"
 
+#define MAP_PAGE	4096					/* granule of the mapping area */
+#define MAP_PAGES	(MAX_MAP / MAP_PAGE)
+
 /* private variables */
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static char *mem_brk_hi;				/* highest brk since the last reset */
+static char *mem_clean;					/* highest brk since mem_init */
+
+static char *map_area;					/* area mem_map() hands out */
+static unsigned char map_used[MAP_PAGES];	/* 1 iff the page is mapped */
+static size_t map_hi;					/* pages past this were never mapped */
+static size_t map_bytes;				/* bytes mapped now */
+static size_t mem_peak;					/* max of heap + mapped bytes */
+
+static void mem_note_peak(void);
 
 /* 
  * mem_init - initialize the memory system model
@@ -32,8 +45,29 @@ void mem_init(void){
 			MAP_PRIVATE,			/* private or shared? */
 			dev_zero,				/* fd */
 			0);						/* offset (dunno) */
+	if (heap == MAP_FAILED) {
+		fprintf(stderr, "ERROR: mem_init failed to map the heap: %s\n",
+				strerror(errno));
+		exit(1);
+	}
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	mem_brk_hi = heap;
+	mem_clean = heap;
+
+	/* the simulated mmap area sits right above the heap */
+	map_area = mmap(heap + MAX_HEAP, MAX_MAP, PROT_WRITE, MAP_PRIVATE,
+			dev_zero, 0);
+	if (map_area == MAP_FAILED) {
+		fprintf(stderr, "ERROR: mem_init failed to map the mmap area: %s\n",
+				strerror(errno));
+		exit(1);
+	}
+	close(dev_zero);
+	memset(map_used, 0, sizeof(map_used));
+	map_hi = 0;
+	map_bytes = 0;
+	mem_peak = 0;
 }
 
 /* 
@@ -41,35 +75,157 @@ void mem_init(void){
  */
 void mem_deinit(void){
 	munmap(heap, MAX_HEAP);
+	munmap(map_area, MAX_MAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *		and drop every mapping
  */
 void mem_reset_brk(){
 	mem_brk = heap;
+	mem_brk_hi = heap;
+	if (map_hi > 0) {
+		madvise(map_area, map_hi * MAP_PAGE, MADV_DONTNEED);
+		memset(map_used, 0, map_hi);
+	}
+	map_hi = 0;
+	map_bytes = 0;
+	mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap and returns the old brk.
  */
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
 
+	if (incr < 0) {
+		if (mem_brk + incr < heap) {
+			errno = EINVAL;
+			return (void *)-1;
+		}
+		/* the real brk is left alone, and the pages stay resident */
+		mem_brk += incr;
+		return (void *)old_brk;
+	}
+
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Regrowing over trimmed space does not move the real brk again.
+	if ( ((mem_brk + incr) > mem_max_addr) ||
+            (mem_brk + incr > mem_brk_hi &&
+             sbrk(mem_brk + incr - mem_brk_hi) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
 	mem_brk += incr;
+	if (mem_brk > mem_brk_hi)
+		mem_brk_hi = mem_brk;
+	if (mem_brk > mem_clean)
+		mem_clean = mem_brk;
+	mem_note_peak();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_map - simple model of an anonymous mmap. Returns size bytes,
+ *		rounded up to whole pages, of zeroed memory in the mapping area,
+ *		lowest address first.
+ */
+void *mem_map(size_t size) {
+	size_t npages = (size + MAP_PAGE - 1) / MAP_PAGE;
+	size_t start = 0;
+	unsigned char *used;
+
+	while (npages > 0 && start + npages <= MAP_PAGES) {
+		if ((used = memchr(map_used + start, 1, npages)) == NULL) {
+			memset(map_used + start, 1, npages);
+			if (start + npages > map_hi)
+				map_hi = start + npages;
+			map_bytes += npages * MAP_PAGE;
+			mem_note_peak();
+			return map_area + start * MAP_PAGE;
+		}
+		start = used - map_used + 1;
+	}
+
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+}
+
+/*
+ * mem_unmap - give the pages of [addr, addr + size) back. addr must be
+ *		page aligned. Unmapped pages read as zero when mapped again.
+ */
+int mem_unmap(void *addr, size_t size) {
+	size_t npages = (size + MAP_PAGE - 1) / MAP_PAGE;
+	size_t start = ((char *)addr - map_area) / MAP_PAGE;
+
+	if ((char *)addr < map_area || ((char *)addr - map_area) % MAP_PAGE ||
+			start + npages > MAP_PAGES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	madvise(addr, npages * MAP_PAGE, MADV_DONTNEED);
+	map_bytes -= npages * MAP_PAGE;
+	memset(map_used + start, 0, npages);
+	return 0;
+}
+
+/*
+ * mem_remap - simple model of mremap with MREMAP_MAYMOVE. Resizes the
+ *		mapping at addr in place when the pages after it are free, and
+ *		moves it otherwise.
+ */
+void *mem_remap(void *addr, size_t old_size, size_t new_size) {
+	size_t oldpages = (old_size + MAP_PAGE - 1) / MAP_PAGE;
+	size_t newpages = (new_size + MAP_PAGE - 1) / MAP_PAGE;
+	size_t start = ((char *)addr - map_area) / MAP_PAGE;
+	void *newp;
+
+	if (newpages <= oldpages) {
+		mem_unmap((char *)addr + newpages * MAP_PAGE,
+				(oldpages - newpages) * MAP_PAGE);
+		return addr;
+	}
+
+	if (start + newpages <= MAP_PAGES &&
+			memchr(map_used + start + oldpages, 1, newpages - oldpages) == NULL) {
+		memset(map_used + start + oldpages, 1, newpages - oldpages);
+		if (start + newpages > map_hi)
+			map_hi = start + newpages;
+		map_bytes += (newpages - oldpages) * MAP_PAGE;
+		mem_note_peak();
+		return addr;
+	}
+
+	if ((newp = mem_map(new_size)) == (void *)-1)
+		return newp;
+	memcpy(newp, addr, oldpages * MAP_PAGE);
+	mem_unmap(addr, old_size);
+	return newp;
+}
+
+/*
+ * mem_mapped - return whether [lo, lo + size) lies in mapped pages
+ */
+int mem_mapped(const void *lo, size_t size) {
+	const char *p = lo;
+	size_t first, last;
+
+	if (p < map_area || p + size > map_area + MAX_MAP || size == 0)
+		return 0;
+	first = (p - map_area) / MAP_PAGE;
+	last = (p + size - 1 - map_area) / MAP_PAGE;
+	return memchr(map_used + first, 0, last - first + 1) == NULL;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -84,6 +240,15 @@ void *mem_heap_hi(){
 	return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_clean_lo - return the lowest heap address that mem_sbrk has never
+ *		handed out since mem_init. The heap from there on still reads as
+ *		zero; below it, mem_reset_brk and shrinking leave old data in place.
+ */
+void *mem_clean_lo(){
+	return (void *)mem_clean;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -91,6 +256,37 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_footprint() - returns the bytes held in the heap and mappings now
+ */
+size_t mem_footprint() {
+	return mem_heapsize() + map_bytes;
+}
+
+/*
+ * mem_mapsize() - returns the bytes currently mapped by mem_map
+ */
+size_t mem_mapsize() {
+	return map_bytes;
+}
+
+/*
+ * mem_peaksize() - returns the most bytes ever held in the heap and
+ *		mappings together since the last reset
+ */
+size_t mem_peaksize() {
+	return mem_peak;
+}
+
+/*
+ * mem_note_peak - fold the current footprint into the peak
+ */
+static void mem_note_peak(void) {
+	size_t now = mem_footprint();
+	if (now > mem_peak)
+		mem_peak = now;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
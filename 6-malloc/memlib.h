@@ -4,8 +4,16 @@ void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void *mem_map(size_t size);
+int mem_unmap(void *addr, size_t size);
+void *mem_remap(void *addr, size_t old_size, size_t new_size);
+int mem_mapped(const void *lo, size_t size);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_clean_lo(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
+size_t mem_footprint(void);
 size_t mem_pagesize(void);
 
@@ -3,21 +3,33 @@
  *
  * This allocator uses segregated list to arrange free blocks.
  * Segregated sizes are powers of 2's: 2^4, 2^5, 2^6, ...
- * First fit policy is used.
- * This allocator also uses a heuristic to reduce sbrk calls:
- * if there's been a peak, allocate twice the current request,
- * otherwise just allocate the max request in history.
- *
- *
+ * Small classes are linked lists, large ones bitwise tries, and a
+ * bitmap of nonempty classes finds the first candidate in one scan.
+ * Fit is bounded best fit. Allocated blocks carry no footer.
+ * In front of the lists sit per-thread caches, quick lists of recently
+ * freed blocks, and slab runs for tiny requests; large requests get a
+ * mapping of their own, and a big free heap top is trimmed.
+ * The allocator is thread safe: one lock guards the heap and the lists,
+ * and slab runs belong to arenas with a lock each.
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+#include <sys/single_threaded.h>
+#define MT_ACTIVE()  (!__libc_single_threaded)
+#else
+#define MT_ACTIVE()  1
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -35,6 +47,11 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define malloc_batch mm_malloc_batch
+#define free_sized mm_free_sized
 #endif /* def DRIVER */
 
 /* single word (4) or double word (8) alignment */
@@ -50,10 +67,33 @@
 #define WSIZE       4       /* Word and header/footer size (bytes) */
 #define DSIZE       8       /* Double word size (bytes) */
 #define PSIZE      (sizeof(void*))      /* Size of a pointer */
-#define MIN_BLKSZ  (DSIZE + PSIZE * 2)  /* Min size of a block */
+#define MIN_BLKSZ  (DSIZE + WSIZE * 2)  /* Min size of a block */
+#define SPLIT_MIN  (MIN_BLKSZ + DSIZE)  /* Min tail split off a block */
 
 #define FL_SIZE     16      /* Size of free list */
+#define FL_LISTS    8       /* Classes below are lists, the rest tries */
 #define FL_MIN      16      /* Minimum size to be maintained by free list */
+#define FIT_PROBES  8       /* Fitting blocks examined before best is taken */
+#define QUICK_MAX   128     /* Largest block kept on a quick list */
+#define QUICK_BINS  (QUICK_MAX / DSIZE + 1)
+#define QUICK_LIMIT 256     /* Quick list bytes that force merging */
+#define ZERO_SLACK  (6 * WSIZE)     /* Free block words past zero_lo */
+
+#if FL_SIZE != MM_STAT_CLASSES
+#error "mm_stats() reports one class per free list"
+#endif
+
+#define PREV_ALLOC  0x2     /* Header bit: previous block is allocated */
+#define MAPPED      0x4     /* Header bit: block is a mapping of its own */
+#define MMAP_MIN   (128 * 1024)         /* Smallest request mapped alone */
+#define MAP_MAX    (MAX_MAP - DSIZE)    /* Largest payload a mapping holds */
+#define TRIM_MIN   (1024 * 1024)         /* Free heap top that gets trimmed */
+#define TRIM_KEEP  (256 * 1024)          /* Free heap top left by a trim */
+
+#define GROW_CHUNK  (1 << 12)   /* Extension unit of the fixed policy */
+#define GROW_RATIO  8           /* Geometric policy grows heap by 1/8 */
+#define GROW_EWMA_SHIFT  2      /* EWMA weight of the newest miss, 1/4 */
+#define GROW_RUN_MAX     16     /* Most equal misses the pattern prefetches */
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
@@ -65,37 +105,172 @@
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MAPPED(p) (GET(p) & MAPPED)
+
+/* Set or clear the prev-allocated bit in the header at address p */
+#define SET_PREV_ALLOC(p)  PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)  PUT(p, GET(p) & ~PREV_ALLOC)
 
 /**
+ * Links are 32-bit offsets from heap_lo, see NEXT_FBP.
+ *
  * Free block looks like
  * +-----------------------------------+
  * | bh | prev | next | empty ... | bt |
  * +-----------------------------------+
  *
+ * Free block in a trie looks like
+ * +-----------------------------------------------------------+
+ * | bh | prev | next | parent | child0 | child1 | empty | bt |
+ * +-----------------------------------------------------------+
+ *
  * Allocated block looks like
- * +-----------------------------+
- * | bh | content ... | pad | bt |
- * +-----------------------------+
- * pad is assigned only when content size < 2 * PSIZE
+ * +------------------------+
+ * | bh | content ... | pad |
+ * +------------------------+
+ * pad is assigned only when content size < 2 * WSIZE + WSIZE
+ *
+ * Besides the allocate bit, bh has PREV_ALLOC set iff the block right
+ * before it is allocated; bt, and hence PREV_ABP, exists only when
+ * the previous block is free.
  *
  * Prologue block looks like
  * +-----------------------+
  * | bh | prev | next | bt |
  * +-----------------------+
  * with prev = next = 0, and allocate bit of bh and bt = 1
+ *
+ * Epilogue is a lone header of size 0 with allocate bit = 1
+ *
+ * Mapped block looks like
+ * +------------------------------+
+ * | pad | bh | content ... | pad |
+ * +------------------------------+
+ * where bh holds the size of the whole mapping and MAPPED is set
  */
 
+#define RUN_SIZE      1024  /* Size and alignment of a slab run, small
+                               so a class's partial run wastes little */
+#define SLAB_MAX        32  /* Largest request served by slab */
+#define SLAB_CLASSES   (SLAB_MAX / DSIZE)   /* One class per 8 bytes */
+#define SLAB_WARMUP    128  /* Requests of a class before it gets runs */
+#define SLAB_MAP_WORDS (RUN_SIZE / DSIZE / 64)  /* Enough for 8-byte objs */
+#define SLAB_PAGES     (MAX_HEAP / RUN_SIZE)
+
+#define MAX_ARENAS       8  /* Slab arenas threads are spread over */
+#define TCACHE_MAX     256  /* Largest payload kept in thread caches */
+#define TCACHE_BINS    (TCACHE_MAX / DSIZE + 1)
+#define TCACHE_FILL     16  /* Blocks in a bin before half is handed back */
+
+/* Take and release a lock, only once there is a second thread. LOCK
+ * reads MT_ACTIVE() once into the caller's int mt and UNLOCK goes by it,
+ * so a lock taken is released even if the process turns single threaded
+ * in between. */
+#define LOCK(m, mt)    do { if (((mt) = MT_ACTIVE())) pthread_mutex_lock(m); } while (0)
+#define UNLOCK(m, mt)  do { if (mt) pthread_mutex_unlock(m); } while (0)
+
+/* Thread cache and quick list entries are chained through their
+ * first word */
+#define TC_NEXT(bp)  (*(char **)(bp))
+#define QL_NEXT(bp)  (*(char **)(bp))
+
+/* Slab class for a request of 1..SLAB_MAX bytes */
+#define SLAB_CLS(size)  (((size) - 1) / DSIZE)
+
+/* Run that slab object bp lives in */
+#define SLAB_RUN(bp)    ((slab_run_t *)((size_t)(bp) & ~(size_t)(RUN_SIZE-1)))
+
+/* Bitmap of nonempty segregated lists */
+#define SEG_MARK(i)    (seg_bitmap |= 1u << (i))
+#define SEG_UNMARK(i)  (seg_bitmap &= ~(1u << (i)))
+
 /* Given block ptr bp, compute addr of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute addr of next/prev allocated blocks */
+/* Given block ptr bp, compute addr of next/prev adjacent blocks.
+ * PREV_ABP is only valid if the previous block is free. */
 #define NEXT_ABP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_ABP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Free blocks link to each other by 32-bit offsets from heap_lo, which
+ * MAX_HEAP allows. Offset 0 is the free list array, never a block, so
+ * it stands for NULL. */
+#define LINK_OFF(p)    ((p) ? (unsigned int)((char *)(p) - heap_lo) : 0)
+#define LINK_PTR(off)  ((off) ? heap_lo + (off) : NULL)
+#define GET_LINK(bp, i)     LINK_PTR(GET((char *)(bp) + (i) * WSIZE))
+#define PUT_LINK(bp, i, p)  PUT((char *)(bp) + (i) * WSIZE, LINK_OFF(p))
+
 /* Given block ptr bp, computer addr of next/prev free blocks */
-#define NEXT_FBP(bp)  (*((char**)(bp) + 1))
-#define PREV_FBP(bp)  (*((char**)(bp)))
+#define NEXT_FBP(bp)  GET_LINK(bp, 1)
+#define PREV_FBP(bp)  GET_LINK(bp, 0)
+#define SET_NEXT_FBP(bp, p)  PUT_LINK(bp, 1, p)
+#define SET_PREV_FBP(bp, p)  PUT_LINK(bp, 0, p)
+
+/* Given tree block ptr bp, compute addr of its parent and children.
+ * Blocks of equal size share one tree node: the others sit in a ring
+ * with it through NEXT_FBP/PREV_FBP and have a NULL parent. The root's
+ * parent is prologp. */
+#define PARENT(bp)     GET_LINK(bp, 2)
+#define CHILD(bp, i)   GET_LINK(bp, 3 + (i))
+#define SET_PARENT(bp, p)    PUT_LINK(bp, 2, p)
+#define SET_CHILD(bp, i, p)  PUT_LINK(bp, 3 + (i), p)
+
+/* Trie key of size in class i: the bits below the class's leading bit,
+ * moved to the top. The last class is unbounded and keys whole sizes. */
+#define TREE_KEY(size, i) \
+    ((unsigned int)(size) << ((i) == FL_SIZE - 1 ? 0 : 29 - (i)))
+
+/**
+ * Slab run header, at the start of every run
+ * +---------------------------------------------+
+ * | slab_run_t | obj 0 | obj 1 | ... | obj n-1 |
+ * +---------------------------------------------+
+ * A run is the payload of an ordinary allocated block of RUN_SIZE bytes,
+ * so the next block's header takes the last word of the run and
+ * consecutive runs tile the heap without gaps.
+ */
+typedef struct slab_run {
+    struct arena* arena;        /* Arena the run belongs to */
+    struct slab_run* next;      /* Next run of the class with free objs */
+    struct slab_run* prev;      /* Prev run of the class with free objs */
+    unsigned int osize;         /* Object size */
+    unsigned int recip;         /* 2^32 / osize rounded up */
+    unsigned short nobjs;       /* Objects in this run */
+    unsigned short nfree;       /* Free objects in this run */
+    unsigned short cls;         /* Slab class */
+    unsigned short hint;        /* No free object in map words below */
+    unsigned long map[SLAB_MAP_WORDS];  /* Bit set iff object is free */
+} slab_run_t;
+
+#define SLAB_HDR    sizeof(slab_run_t)
+
+/* Per-class slab state */
+typedef struct {
+    slab_run_t* partial;        /* Runs with free objects */
+    size_t nreqs;               /* Requests seen, saturates at warmup */
+} slab_cls_t;
+
+/* Slab classes of an arena, kept in the heap next to the free lists */
+typedef struct arena {
+    pthread_mutex_t lock;       /* Guards the classes and their runs */
+    slab_cls_t cls[SLAB_CLASSES];
+} arena_t;
+
+/* Per-thread cache, bin i holds blocks with 8i..8i+7 usable bytes */
+typedef struct {
+    unsigned long gen;          /* heap_gen the cached blocks belong to */
+    arena_t* arena;             /* Arena of this thread */
+    char* head[TCACHE_BINS];
+    int count[TCACHE_BINS];
+} tcache_t;
+
+/* A heap growth policy: bytes to extend by for a miss of asize */
+typedef struct {
+    const char* name;
+    size_t (*grow)(size_t asize);
+} growth_t;
 
 /**
  * Globals
@@ -104,53 +279,151 @@
 static char** free_listp = 0;
 static char* prologp = 0;    /* Pointer to prologue */
 static size_t max_asize = 0;  /* Max alloc size so far */
+static size_t miss_ewma = 0;  /* Average miss size, for the ewma policy */
+static size_t miss_last = 0;  /* Last miss size, for the pattern policy */
+static size_t miss_run = 0;   /* Equal misses in a row so far */
+static unsigned int seg_bitmap = 0;  /* Bit i set iff free list i nonempty */
+static char* quick_head[QUICK_BINS];  /* Quick list i holds blocks of 8i+ */
+static size_t quick_bytes = 0;        /* Bytes on the quick lists */
+static size_t free_count[FL_SIZE];    /* Blocks in free list i */
+static size_t free_bytes[FL_SIZE];    /* Bytes in free list i */
+static size_t heap_peak = 0;  /* Largest heap size since mm_init */
+static size_t sbrk_calls = 0; /* mem_sbrk calls since mm_init */
+static size_t map_count = 0;  /* Blocks mapped alone now */
+static size_t map_calls = 0;  /* mem_map and mem_remap calls */
+/* The heap from zero_lo to the brk reads as zero, but for the header and
+ * links in the first ZERO_SLACK bytes past zero_lo, the epilogue, and
+ * the footer of the free block at the top */
+static char* zero_lo = 0;
+static char* zero_from = 0;   /* Known zero part of the last placed block */
+static char* heap_lo = 0;           /* First heap byte, base of page map */
+/* Bit i set iff the heap's i'th RUN_SIZE slot is a slab run */
+static unsigned long slab_pagemap[SLAB_PAGES / 64 + 1];
+
+/* Guards the free lists, the heap and the arena table */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static arena_t* arenas[MAX_ARENAS];  /* arenas[0] is made by mm_init */
+static int narenas = 0;             /* Arenas threads are spread over */
+static unsigned int next_arena = 0; /* Round robin arena assignment */
+static unsigned long heap_gen = 0;  /* Bumped by mm_init, stales caches */
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;    /* Flushes the cache on thread exit */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
 
 /**
  * Function prototypes
  */
 static void* extend_heap(size_t size);
+static size_t grow_peak(size_t asize);
+static size_t grow_fixed(size_t asize);
+static size_t grow_geometric(size_t asize);
+static size_t grow_ewma(size_t asize);
+static size_t grow_pattern(size_t asize);
+static void* grow_heap(size_t asize);
+static void* heap_sbrk(size_t incr);
+static char* take_zero(char* bp);
 static void* find_fit(size_t asize);
 static void* coalesce(char* bp);
 static void place(char* bp, size_t asize);
+static void* malloc_block(size_t asize);
+static void* map_block(size_t size);
+static void* remap_block(char* bp, size_t size);
+static void free_block(char* bp);
+static void quick_free(char* bp, size_t size);
+static void quick_merge(void);
+static void trim_heap(char* bp);
+static size_t adjust_size(size_t size);
+static int resize_inplace(char* bp, size_t asize);
+static void* find_aligned(size_t asize, size_t align);
+static int slab_owns(const void* bp);
+static void* slab_malloc(size_t size);
+static void* slab_alloc(arena_t* a, int cls);
+static void slab_free(char* bp);
+static tcache_t* tcache_self(void);
+static void* tcache_take(size_t size);
+static int tcache_keep(char* bp, size_t usable);
+static void tcache_flush(tcache_t* tc, int bin, int n);
 static int find_segidx(size_t asize);
+static void tree_insert(char* bp, int segidx);
+static void tree_delete(char* bp, int segidx);
+static char* tree_best(size_t asize, int segidx);
+static char* tree_smallest(char* t);
+static size_t tree_largest(char* t);
+static char* tree_aligned(char* t, size_t asize, size_t align);
+static void check_tree(char* t, char* parent, int segidx, int depth,
+                       unsigned int prefix, int lineno);
+static void check_zero(char* bp, int lineno);
 static void delete_node(char* bp, int segidx);
 static void insert_node(char* bp, int segidx);
 
+/* Policies mm_set_growth() picks from, the first is the default */
+static const growth_t growths[] = {
+    { "peak",      grow_peak },
+    { "fixed",     grow_fixed },
+    { "geometric", grow_geometric },
+    { "ewma",      grow_ewma },
+    { "pattern",   grow_pattern },
+};
+static const growth_t* growth = &growths[0];
+
 /*
  * Initialize - return -1 on error, 0 on success.
  */
 int mm_init(void) {
     int i;
     /* Create free list */
-    if ((free_listp = mem_sbrk(FL_SIZE * PSIZE)) == (void*) -1) {
+    sbrk_calls = map_calls = map_count = heap_peak = 0;
+    if ((free_listp = heap_sbrk(FL_SIZE * PSIZE)) == (void*) -1) {
+        return -1;
+    }
+    heap_lo = (char *)free_listp;
+
+    /* Create the first arena, the others are made on demand */
+    memset(arenas, 0, sizeof(arenas));
+    if ((arenas[0] = heap_sbrk(sizeof(arena_t))) == (void*) -1) {
+        arenas[0] = NULL;
         return -1;
     }
+    memset(arenas[0], 0, sizeof(arena_t));
+    pthread_mutex_init(&arenas[0]->lock, NULL);
+    memset(slab_pagemap, 0, sizeof(slab_pagemap));
+    max_asize = miss_ewma = miss_last = miss_run = 0;
+    heap_gen++;     /* blocks in thread caches are gone */
 
     /*
      * Size includes pad(WSIZE), prelog_header(WSIZE),
-     *               prev(PSIZE), next(PSIZE),
+     *               prev(WSIZE), next(WSIZE),
      *               prelog_tail(WSIZE), epilog_header(WSIZE).
      */
-    size_t asize = 4 * WSIZE + 2 * PSIZE;   /* size to be alloc */
-    size_t psize = DSIZE + 2 * PSIZE;       /* prolog size */
+    size_t asize = 6 * WSIZE;               /* size to be alloc */
+    size_t psize = MIN_BLKSZ;               /* prolog size */
     /* Create prologue and epilogue */
-    if ((prologp = mem_sbrk(asize)) == (void *)-1)
+    if ((prologp = heap_sbrk(asize)) == (void *)-1)
         return -1;
 
     /* Initialize prologue and epilogue */
     PUT(prologp, 0);                            /* Alignment padding */
     prologp += DSIZE;
     PUT(HDRP(prologp), PACK(psize, 1));         /* Prologue header */
-    PREV_FBP(prologp) = 0;                      /* Prologue prev */
-    NEXT_FBP(prologp) = 0;                      /* Prologue next */
+    SET_PREV_FBP(prologp, NULL);                /* Prologue prev */
+    SET_NEXT_FBP(prologp, NULL);                /* Prologue next */
     PUT(FTRP(prologp), PACK(psize, 1));         /* Prologue footer */
     /* Epilogue header will serve as next allocated header */
-    PUT(FTRP(prologp) + WSIZE, PACK(0, 1));     /* Epilogue header */
+    PUT(FTRP(prologp) + WSIZE, PACK(0, 1 | PREV_ALLOC)); /* Epilogue */
+    zero_lo = (char *)mem_heap_hi() + 1;
+    if (zero_lo < (char *)mem_clean_lo()) {
+        zero_lo = mem_clean_lo();
+    }
 
     /* Make free lists point to prolog */
     for (i = 0; i < FL_SIZE; i++) {
-        free_listp[i] = prologp;
+        free_listp[i] = i < FL_LISTS ? prologp : NULL;
     }
+    seg_bitmap = 0;
+    memset(free_count, 0, sizeof(free_count));
+    memset(free_bytes, 0, sizeof(free_bytes));
+    memset(quick_head, 0, sizeof(quick_head));
+    quick_bytes = 0;
 
     return 0;
 }
@@ -159,6 +432,7 @@ int mm_init(void) {
  * malloc - Allocate a block with at least size bytes of payload
  */
 void* malloc(size_t size) {
+    int mt;
     size_t asize;      /* Adjusted block size */
     char *bp;
 
@@ -169,80 +443,292 @@ void* malloc(size_t size) {
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
+    /* No path serves more, and adjust_size() would wrap near SIZE_MAX */
+    if (size > MAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= PSIZE + PSIZE)
-        /* Content should be at least 2 ptr's size */
-        asize = MIN_BLKSZ;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    if (MT_ACTIVE() && size <= TCACHE_MAX &&
+        (bp = tcache_take(size)) != NULL) {
+        return bp;
+    }
+
+    /* Tiny requests go to slab once their class is warm */
+    if (size <= SLAB_MAX && (bp = slab_malloc(size)) != NULL) {
+        return bp;
+    }
+
+    if (size >= MMAP_MIN) {
+        return map_block(size);
+    }
+
+    asize = adjust_size(size);
+
+    LOCK(&heap_lock, mt);
+    bp = malloc_block(asize);
+    UNLOCK(&heap_lock, mt);
+    return bp;
+}
+
+/*
+ * malloc_batch - Allocate n blocks of at least size bytes each into
+ *                out[0..n-1] and return how many were allocated. Heap
+ *                blocks come from the quick list of their size, then
+ *                back to back from one fit for all the rest.
+ */
+size_t malloc_batch(size_t size, size_t n, void** out) {
+    int mt;
+    size_t asize;
+    size_t i = 0;
+    size_t rest;
+    size_t prev_alloc;
+    char* bp;
+
+    if (free_listp == 0){
+        mm_init();
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+    if (size > MAP_MAX) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    asize = adjust_size(size);
+    if (size > SLAB_MAX && size < MMAP_MIN) {
+        LOCK(&heap_lock, mt);
+        while (i < n && asize <= QUICK_MAX &&
+               (bp = quick_head[asize / DSIZE]) != NULL) {
+            quick_head[asize / DSIZE] = QL_NEXT(bp);
+            quick_bytes -= asize;
+            out[i++] = bp;
+        }
+        if (i < n && n - i <= MAX_HEAP / asize &&
+            (bp = find_fit(asize * (n - i))) != NULL) {
+            place(bp, asize * (n - i));
+            /* The last block keeps any tail place() did not split off */
+            rest = GET_SIZE(HDRP(bp));
+            prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+            for (; i < n; i++) {
+                size_t bsize = i < n - 1 ? asize : rest;
+                PUT(HDRP(bp), PACK(bsize, 1 | prev_alloc));
+                out[i] = bp;
+                bp += bsize;
+                rest -= bsize;
+                prev_alloc = PREV_ALLOC;
+            }
+        }
+        UNLOCK(&heap_lock, mt);
+    }
+
+    /* Slab and mapped sizes, or a batch too big for one fit */
+    for (; i < n && (out[i] = malloc(size)) != NULL; i++)
+        ;
+    return i;
+}
+
+/*
+ * malloc_block - Take a block of asize from its quick list, or find a
+ *                fit and place it. Allocate when necessary.
+ *                Caller holds heap_lock.
+ */
+static void* malloc_block(size_t asize) {
+    char* bp;
+
+    if (asize <= QUICK_MAX && (bp = quick_head[asize / DSIZE]) != NULL) {
+        quick_head[asize / DSIZE] = QL_NEXT(bp);
+        quick_bytes -= asize;
+        return bp;
+    }
 
-    /* Find a fit. Allocate when necessary */
     bp = find_fit(asize);
-    place(bp, asize);
+    if (bp != NULL) {
+        place(bp, asize);
+    }
+    return bp;
+}
+
+/*
+ * map_block - Map a block of its own with at least size bytes of payload.
+ *             Requests of MMAP_MIN bytes or more come here; the block
+ *             is marked MAPPED and unmapped on free, so its pages go
+ *             back at once.
+ *             Sizes no mapping can hold fail with ENOMEM before the
+ *             rounding below can wrap around.
+ */
+static void* map_block(size_t size) {
+    int mt;
+    size_t msize;
+    char* bp;
+
+    if (size > MAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    msize = (size + DSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+
+    LOCK(&heap_lock, mt);
+    bp = mem_map(msize);
+    map_calls++;
+    if (bp != (void *)-1) {
+        map_count++;
+    }
+    UNLOCK(&heap_lock, mt);
+    if (bp == (void *)-1) {
+        return NULL;
+    }
+
+    bp += DSIZE;
+    PUT(HDRP(bp), PACK(msize, 1 | MAPPED));
     return bp;
 }
 
+/*
+ * remap_block - Resize mapped block bp to hold size bytes of payload.
+ *               It may move. Return NULL on failure, bp is kept then.
+ */
+static void* remap_block(char* bp, size_t size) {
+    int mt;
+    size_t msize;
+    char* base;
+
+    if (size > MAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    msize = (size + DSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+
+    LOCK(&heap_lock, mt);
+    base = mem_remap(bp - DSIZE, GET_SIZE(HDRP(bp)), msize);
+    map_calls++;
+    UNLOCK(&heap_lock, mt);
+    if (base == (void *)-1) {
+        return NULL;
+    }
+
+    bp = base + DSIZE;
+    PUT(HDRP(bp), PACK(msize, 1 | MAPPED));
+    return bp;
+}
+
+/*
+ * adjust_size - Adjust block size to include header and alignment reqs.
+ */
+static size_t adjust_size(size_t size) {
+    if (size <= MIN_BLKSZ - WSIZE)
+        /* Block should be able to hold 2 ptr's and a footer once freed */
+        return MIN_BLKSZ;
+    else
+        return DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+}
+
 /*
  * place - Place block of asize bytes at start of free block bp
- *         and split if remainder would be at least minimum block size
+ *         and split if remainder would be at least SPLIT_MIN bytes
  */
 static void place(char* bp, size_t asize) {
     size_t csize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char* rest;
 
-    if ((csize - asize) >= MIN_BLKSZ) {
+    if ((csize - asize) >= SPLIT_MIN) {
         delete_node(bp, -1);    /* delete BEFORE size change */
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        PUT(HDRP(bp), PACK(asize, 1 | prev_alloc));
 
-        bp = NEXT_ABP(bp);
-        PUT(HDRP(bp), PACK(csize-asize, 0));
-        PUT(FTRP(bp), PACK(csize-asize, 0));
-        insert_node(bp, -1);    /* insert AFTER size change */
+        rest = NEXT_ABP(bp);
+        PUT(HDRP(rest), PACK(csize-asize, PREV_ALLOC));
+        PUT(FTRP(rest), PACK(csize-asize, 0));
+        insert_node(rest, -1);  /* insert AFTER size change */
     }
     else {
         delete_node(bp, -1);
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, 1 | prev_alloc));
+        SET_PREV_ALLOC(HDRP(NEXT_ABP(bp)));
+    }
+    zero_from = take_zero(bp);
+}
+
+/*
+ * take_zero - Note that block bp is now allocated, so its payload leaves
+ *             the zero stretch. Return where the part of the payload
+ *             that was in the stretch starts, or NULL if none was.
+ */
+static char* take_zero(char* bp) {
+    char* end = HDRP(NEXT_ABP(bp));
+    char* zero = bp > zero_lo ? bp : zero_lo;
+
+    if (zero >= end) {
+        return NULL;
     }
+    zero_lo = end;
+    return zero;
 }
 
 /*
  * find_fit - Find a fit in segregated list.
- *            Allocate when necessary.
+ *            Only nonempty lists at or above asize's index are probed;
+ *            seg_bitmap yields the first of them in one bit scan.
+ *            Take the best of the first FIT_PROBES fitting blocks,
+ *            so the LIFO order of the lists does not matter much.
+ *            In the tries, take the best fit of asize's own class,
+ *            else the smallest block of the next nonempty one.
+ *            Merge the quick lists, and allocate when still necessary.
  */
 static void* find_fit(size_t asize) {
     int segidx = find_segidx(asize);
+    unsigned int bins = seg_bitmap & (~0u << segidx) &
+                        ((1u << FL_LISTS) - 1);
 
-    /* Find a free block pointer; first fit */
-    int i;
     char* bp;
-    int found = 0;
-
-    for (i = segidx; i < FL_SIZE; i++) {
-        bp = free_listp[i];
-         /* find a fit within sp */
-        while (1) {
-            if (GET_ALLOC(HDRP(bp))) {
-                /* End of free list is prologue, prologue is allocated */
-                break;
-            }
-
-            if (GET_SIZE(HDRP(bp)) >= asize) {
-                found = 1;
-                break;
+    char* best = NULL;
+    size_t best_size = 0;
+    size_t size;
+    int probes;
+
+    while (bins) {
+        bp = free_listp[__builtin_ctz(bins)];
+        probes = 0;
+        /* find a fit within sp; end of free list is prologue */
+        while (bp != prologp) {
+            size = GET_SIZE(HDRP(bp));
+            if (size >= asize) {
+                if (size == asize) {
+                    return bp;      /* cannot do better */
+                }
+                if (!best || size < best_size) {
+                    best = bp;
+                    best_size = size;
+                }
+                if (++probes == FIT_PROBES) {
+                    break;
+                }
             }
+            bp = NEXT_FBP(bp);
+        }
 
-            char *next = NEXT_FBP(bp);
-            if (!next) {
-                break;
-            }
-            bp = next;
+        if (best) {
+            return best;
         }
+        bins &= bins - 1;   /* drop the list just probed */
+    }
 
-        if (found) {
+    bins = seg_bitmap & (~0u << segidx) & (~0u << FL_LISTS);
+    if (bins && __builtin_ctz(bins) == segidx) {
+        if ((bp = tree_best(asize, segidx)) != NULL) {
             return bp;
         }
+        bins &= bins - 1;
+    }
+    if (bins) {
+        return tree_smallest(free_listp[__builtin_ctz(bins)]);
+    }
+
+    if (quick_bytes > 0) {
+        quick_merge();
+        return find_fit(asize);
     }
 
     bp = extend_heap(asize);
@@ -251,191 +737,714 @@ static void* find_fit(size_t asize) {
 }
 
 /*
- * find_segidx - Find index in segregated list
+ * align_in - Return the first align-aligned address in free block bp
+ *            that leaves either no leading slack or a whole free block.
  */
-static int find_segidx(size_t asize) {
-    int segidx = 0;         /* Index in segregated list */
-    int rsize;              /* Remaining size when finding a fit */
-    for (rsize = asize / FL_MIN;
-         rsize > 0 && segidx < FL_SIZE - 1;
-         rsize >>= 1, segidx++);
-    return segidx;
+static char* align_in(char* bp, size_t align) {
+    char* abp = (char *)(((size_t)bp + align - 1) & ~(align - 1));
+    if (abp != bp && (size_t)(abp - bp) < MIN_BLKSZ) {
+        abp += align;
+    }
+    return abp;
 }
 
 /*
- * insert_node - Insert bp into segidx'th free list as first node.
- *               If segidx < 0, find it.
- *               Maintain the ascending order as optimization.
+ * find_aligned - Find a free block and carve an allocated block of asize
+ *                whose payload is align-aligned (a power of 2, > DSIZE).
+ *                Leading slack goes back to the free lists, so
+ *                alignment costs no more than that slack.
  */
-static void insert_node(char* bp, int segidx) {
-    if (segidx < 0) {
-        segidx = find_segidx(GET_SIZE(HDRP(bp)));
+static void* find_aligned(size_t asize, size_t align) {
+    unsigned int bins = seg_bitmap & (~0u << find_segidx(asize));
+    char* bp = NULL;
+    char* abp;
+
+    /* First fit, counting the slack each block needs */
+    while (bins && !bp) {
+        if (__builtin_ctz(bins) >= FL_LISTS) {
+            bp = tree_aligned(free_listp[__builtin_ctz(bins)], asize, align);
+            bins &= bins - 1;
+            continue;
+        }
+        for (bp = free_listp[__builtin_ctz(bins)]; bp != prologp;
+             bp = NEXT_FBP(bp)) {
+            abp = align_in(bp, align);
+            if ((size_t)(abp - bp) + asize <= GET_SIZE(HDRP(bp))) {
+                break;
+            }
+        }
+        if (bp == prologp) {
+            bp = NULL;
+        }
+        bins &= bins - 1;
     }
 
-    /* Find bp's location */
-    size_t size = GET_SIZE(HDRP(bp));
-    char *prev, *ptr;
-    for (prev = NULL, ptr = free_listp[segidx];
-         ptr != prologp && GET_SIZE(HDRP(ptr)) < size;
-         prev = ptr, ptr = NEXT_FBP(ptr));
-
-    /* Insert before ptr */
-    if (prev) {     /* Insert between prev and ptr */
-        NEXT_FBP(prev) = bp;
-        NEXT_FBP(bp) = ptr;
-        PREV_FBP(ptr) = bp;
-        PREV_FBP(bp) = prev;
-    } else {        /* Insert to first */
-        free_listp[segidx] = bp;
-        PREV_FBP(bp) = NULL;
-        NEXT_FBP(bp) = ptr;
-        PREV_FBP(NEXT_FBP(bp)) = bp;
+    if (!bp && quick_bytes > 0) {
+        quick_merge();
+        return find_aligned(asize, align);
     }
 
-    /* Trick: prologp forgets prev */
-    PREV_FBP(prologp) = NULL;
+    if (!bp) {
+        /* Grow just enough to fit the aligned block at heap top */
+        char* end = (char *)mem_heap_hi() + 1;
+        bp = GET_PREV_ALLOC(HDRP(end)) ? end : PREV_ABP(end);
+        abp = align_in(bp, align);
+        if ((bp = grow_heap(abp + asize - end)) == NULL) {
+            return NULL;
+        }
+    }
+    abp = align_in(bp, align);
+
+    if (abp != bp) {
+        size_t csize = GET_SIZE(HDRP(bp));
+        size_t lead = abp - bp;
+
+        delete_node(bp, -1);
+        PUT(HDRP(bp), PACK(lead, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(lead, 0));
+        insert_node(bp, -1);
+
+        PUT(HDRP(abp), PACK(csize - lead, 0));
+        PUT(FTRP(abp), PACK(csize - lead, 0));
+        insert_node(abp, -1);
+    }
+
+    place(abp, asize);
+    return abp;
 }
 
 /*
- * delete_node - Delete bp from segidx'th free list.
- *               If segidx < 0, find it.
+ * find_segidx - Find index in segregated list.
+ *               It is the bit length of asize / FL_MIN,
+ *               capped at the last class.
  */
-static void delete_node(char* bp, int segidx) {
-    if (segidx < 0) {
-        segidx = find_segidx(GET_SIZE(HDRP(bp)));
+static int find_segidx(size_t asize) {
+    size_t rsize = asize / FL_MIN;
+    int segidx;
+
+    if (rsize == 0) {
+        return 0;
     }
+    segidx = (int)(sizeof(rsize) * 8) - __builtin_clzl(rsize);
+    return segidx < FL_SIZE - 1 ? segidx : FL_SIZE - 1;
+}
 
-    char* prev = PREV_FBP(bp);
-    char* next = NEXT_FBP(bp);
+/*
+ * tree_insert - Insert bp into the trie of class segidx. Classes from
+ *               FL_LISTS up are bitwise tries, as in dlmalloc's tree
+ *               bins, which give exact best fit in one walk. The path to
+ *               bp's node follows the bits of its key from the top; if a
+ *               node of equal size is met on the way, bp joins its ring.
+ */
+static void tree_insert(char* bp, int segidx) {
+    unsigned int size = GET_SIZE(HDRP(bp));
+    unsigned int key = TREE_KEY(size, segidx);
+    char* parent = prologp;
+    char* t = free_listp[segidx];
+    char* c;
+
+    SET_CHILD(bp, 0, NULL);
+    SET_CHILD(bp, 1, NULL);
+    while (t != NULL && GET_SIZE(HDRP(t)) != size) {
+        if ((c = CHILD(t, key >> 31)) == NULL) {
+            SET_CHILD(t, key >> 31, bp);
+            parent = t;
+            t = NULL;
+            break;
+        }
+        t = c;
+        key <<= 1;
+    }
 
-    /* prologp will always be the last */
-    /* need to see if bp has prev */
-    if (prev) {
-        NEXT_FBP(prev) = next;
-        PREV_FBP(next) = prev;
+    if (t == NULL) {
+        if (parent == prologp) {
+            free_listp[segidx] = bp;
+        }
+        SET_PARENT(bp, parent);
+        SET_PREV_FBP(bp, bp);
+        SET_NEXT_FBP(bp, bp);
     } else {
-        PREV_FBP(next) = NULL;      /* next no longer has prev */
-        free_listp[segidx] = next;  /* first element in list becomes next */
+        SET_PARENT(bp, NULL);
+        SET_PREV_FBP(bp, t);
+        SET_NEXT_FBP(bp, NEXT_FBP(t));
+        SET_PREV_FBP(NEXT_FBP(t), bp);
+        SET_NEXT_FBP(t, bp);
     }
-
-    /* Trick: prologp forgets prev */
-    PREV_FBP(prologp) = NULL;
+    SEG_MARK(segidx);
 }
 
 /*
- * extend_heap - Extend heap with at least size bytes.
- *               Return its block pointer.
- *
- *               heuristic is that, unless max was a peak, we may
- *               take max_asize as avg level of the requests, and
- *               allocate max_size as newly extended size.
- *               If max was a peak, we just allocate twice as much
- *               to save sbrk calls.
+ * tree_delete - Delete bp from the trie of class segidx. A node is
+ *               replaced by a block of its ring, or else by the deepest
+ *               leaf below it.
  */
-static void* extend_heap(size_t size) {
-    size_t words = size / WSIZE; /* Size of extension in words */
-    /* Allocate an even number of words to maintain alignment */
-    size_t asize = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+static void tree_delete(char* bp, int segidx) {
+    char* parent = PARENT(bp);
+    char* r = NULL;
+    char* c;
+
+    if (NEXT_FBP(bp) != bp) {
+        r = PREV_FBP(bp);
+        SET_NEXT_FBP(r, NEXT_FBP(bp));
+        SET_PREV_FBP(NEXT_FBP(bp), r);
+    } else if ((r = CHILD(bp, 1)) != NULL || (r = CHILD(bp, 0)) != NULL) {
+        while ((c = CHILD(r, 1)) != NULL || (c = CHILD(r, 0)) != NULL) {
+            r = c;
+        }
+        c = PARENT(r);
+        SET_CHILD(c, CHILD(c, 1) == r, NULL);
+    }
 
-    if (asize > max_asize) {
-        max_asize = asize;
+    if (parent == NULL) {
+        return;     /* bp was in a ring, not in the trie */
     }
 
-    if (max_asize > 2 * asize) {
-        /* That max may just be a peak */
-        asize *= 2;
+    if (parent == prologp) {
+        free_listp[segidx] = r;
     } else {
-        /* Otherwise it's very likely we're just about this level */
-        asize = max_asize;
+        SET_CHILD(parent, CHILD(parent, 1) == bp, r);
+    }
+    if (r != NULL) {
+        SET_PARENT(r, parent);
+        SET_CHILD(r, 0, CHILD(bp, 0));
+        SET_CHILD(r, 1, CHILD(bp, 1));
+        if (CHILD(r, 0) != NULL) {
+            SET_PARENT(CHILD(r, 0), r);
+        }
+        if (CHILD(r, 1) != NULL) {
+            SET_PARENT(CHILD(r, 1), r);
+        }
     }
 
+    if (free_listp[segidx] == NULL) {
+        SEG_UNMARK(segidx);
+    }
+}
 
-    char* bp;
-    if ((long)(bp = mem_sbrk(asize)) == -1)
-        return NULL;
+/*
+ * tree_best - Return the smallest block of at least asize in the trie
+ *             of asize's class segidx, or NULL. Along the path of
+ *             asize's key, every subtree to the right holds only larger
+ *             blocks; the smallest of the deepest one is on its leftmost
+ *             path.
+ */
+static char* tree_best(size_t asize, int segidx) {
+    unsigned int key = TREE_KEY(asize, segidx);
+    size_t rsize = ~(size_t)0;  /* Slack of best so far */
+    char* best = NULL;
+    char* rst = NULL;           /* Deepest right subtree passed by */
+    char* t = free_listp[segidx];
+    char* rt;
+
+    while (t != NULL) {
+        size_t size = GET_SIZE(HDRP(t));
+        if (size >= asize && size - asize < rsize) {
+            best = t;
+            rsize = size - asize;
+            if (rsize == 0) {
+                break;
+            }
+        }
+        rt = CHILD(t, 1);
+        t = CHILD(t, key >> 31);
+        if (rt != NULL && rt != t) {
+            rst = rt;
+        }
+        key <<= 1;
+    }
 
-    /* Initialize free block header/footer*/
-    PUT(HDRP(bp), PACK(asize, 0));         /* Free block header */
-    PUT(FTRP(bp), PACK(asize, 0));         /* Free block footer */
-    PUT(HDRP(NEXT_ABP(bp)), PACK(0, 1));   /* New epilogue header */
+    if (rsize != 0 && rst != NULL) {
+        t = tree_smallest(rst);
+        if (GET_SIZE(HDRP(t)) - asize < rsize) {
+            return t;
+        }
+    }
 
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);
+    /* A ring mate leaves the trie without any relinking */
+    return best ? NEXT_FBP(best) : NULL;
 }
 
 /*
- * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ * tree_smallest - Return the smallest block in the subtree at t, which
+ *                 lies on its leftmost path.
  */
-static void* coalesce(char* bp) {
-    char* prev_bp = PREV_ABP(bp);
-    int prev_alloc = GET_ALLOC(HDRP(prev_bp));
-    char* next_bp = NEXT_ABP(bp);
-    int next_alloc = GET_ALLOC(HDRP(next_bp));
-    size_t size = GET_SIZE(HDRP(bp));
+static char* tree_smallest(char* t) {
+    char* best = t;
 
-    if (prev_alloc && next_alloc) {            /* Cannot coalesce */
-        insert_node(bp, -1);
-        return bp;
+    while ((t = CHILD(t, 0) != NULL ? CHILD(t, 0) : CHILD(t, 1)) != NULL) {
+        if (GET_SIZE(HDRP(t)) < GET_SIZE(HDRP(best))) {
+            best = t;
+        }
     }
+    return NEXT_FBP(best);
+}
 
-    else if (prev_alloc && !next_alloc) {      /* Coalesce next */
-        delete_node(next_bp, -1);
-        size += GET_SIZE(HDRP(next_bp));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size,0));
-        insert_node(bp, -1);
-    }
+/*
+ * tree_largest - Return the size of the largest block in the subtree at
+ *                t, which lies on its rightmost path.
+ */
+static size_t tree_largest(char* t) {
+    size_t best = 0;
 
-    else if (!prev_alloc && next_alloc) {      /* Coalesce prev */
-        delete_node(prev_bp, -1);
-        size += GET_SIZE(HDRP(prev_bp));
-        bp = prev_bp;
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
-        insert_node(bp, -1);
+    for (; t != NULL; t = CHILD(t, 1) != NULL ? CHILD(t, 1) : CHILD(t, 0)) {
+        if (GET_SIZE(HDRP(t)) > best) {
+            best = GET_SIZE(HDRP(t));
+        }
     }
+    return best;
+}
 
-    else {                                     /* Coalesce both */
-        delete_node(prev_bp, -1);
-        delete_node(next_bp, -1);
-        size += GET_SIZE(HDRP(prev_bp)) +
-                GET_SIZE(HDRP(next_bp));
-        bp = prev_bp;
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
-        insert_node(bp, -1);
+/*
+ * tree_aligned - Return the first block in the subtree at t that can
+ *                hold an align-aligned block of asize, or NULL.
+ */
+static char* tree_aligned(char* t, size_t asize, size_t align) {
+    char* bp;
+
+    if (t == NULL) {
+        return NULL;
     }
 
-    return bp;
+    bp = t;
+    do {
+        if ((size_t)(align_in(bp, align) - bp) + asize <= GET_SIZE(HDRP(bp))) {
+            return bp;
+        }
+        bp = NEXT_FBP(bp);
+    } while (bp != t);
+
+    if ((bp = tree_aligned(CHILD(t, 0), asize, align)) != NULL) {
+        return bp;
+    }
+    return tree_aligned(CHILD(t, 1), asize, align);
 }
 
 /*
- * free - Free a block
+ * insert_node - Insert bp into segidx'th free list as first node,
+ *               in O(1), or into its trie. If segidx < 0, find it.
+ *               The list's block and byte counts are kept up to date
+ *               here and in delete_node, for mm_stats().
  */
-void free(void *bp) {
-    if (bp == 0 ||
-        !GET_ALLOC(HDRP(bp))
-        ) {
+static void insert_node(char* bp, int segidx) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (segidx < 0) {
+        segidx = find_segidx(size);
+    }
+    free_count[segidx]++;
+    free_bytes[segidx] += size;
+    if (segidx >= FL_LISTS) {
+        tree_insert(bp, segidx);
         return;
     }
 
-    if (free_listp == 0){
-        mm_init();
-    }
+    char* next = free_listp[segidx];
 
-    size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+    free_listp[segidx] = bp;
+    SET_PREV_FBP(bp, NULL);
+    SET_NEXT_FBP(bp, next);
+    SET_PREV_FBP(next, bp);
+    SEG_MARK(segidx);
 
-    coalesce(bp);
+    /* Trick: prologp forgets prev */
+    SET_PREV_FBP(prologp, NULL);
+}
+
+/*
+ * delete_node - Delete bp from segidx'th free list or trie.
+ *               If segidx < 0, find it.
+ */
+static void delete_node(char* bp, int segidx) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (segidx < 0) {
+        segidx = find_segidx(size);
+    }
+    free_count[segidx]--;
+    free_bytes[segidx] -= size;
+    if (segidx >= FL_LISTS) {
+        tree_delete(bp, segidx);
+        return;
+    }
+
+    char* prev = PREV_FBP(bp);
+    char* next = NEXT_FBP(bp);
+
+    /* prologp will always be the last */
+    /* need to see if bp has prev */
+    if (prev) {
+        SET_NEXT_FBP(prev, next);
+        SET_PREV_FBP(next, prev);
+    } else {
+        SET_PREV_FBP(next, NULL);      /* next no longer has prev */
+        free_listp[segidx] = next;  /* first element in list becomes next */
+        if (next == prologp) {
+            SEG_UNMARK(segidx);     /* list is empty now */
+        }
+    }
+
+    /* Trick: prologp forgets prev */
+    SET_PREV_FBP(prologp, NULL);
+}
+
+/*
+ * extend_heap - Extend heap with at least size bytes, as much as the
+ *               growth policy asks for. Return its block pointer.
+ */
+static void* extend_heap(size_t size) {
+    size_t words = size / WSIZE; /* Size of extension in words */
+    /* Allocate an even number of words to maintain alignment */
+    size_t asize = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+
+    return grow_heap(growth->grow(asize));
+}
+
+/*
+ * mm_growth_name - Return the name of growth policy i, or NULL if
+ *                  there is no such policy.
+ */
+const char* mm_growth_name(int i) {
+    if (i < 0 || i >= (int)(sizeof(growths) / sizeof(growths[0]))) {
+        return NULL;
+    }
+    return growths[i].name;
+}
+
+/*
+ * mm_set_growth - Make growth policy i the one extend_heap uses.
+ *                 The default, grow_peak, cuts sbrk calls; the others
+ *                 grow by whole chunks, by a fraction of the heap, by an
+ *                 average of past misses, or by a run of equal misses.
+ *                 Return -1 if there is no such policy, 0 otherwise.
+ */
+int mm_set_growth(int i) {
+    if (mm_growth_name(i) == NULL) {
+        return -1;
+    }
+    growth = &growths[i];
+    return 0;
+}
+
+/*
+ * grow_peak - heuristic is that, unless max was a peak, we may
+ *             take max_asize as avg level of the requests, and
+ *             allocate max_size as newly extended size.
+ *             If max was a peak, we just allocate twice as much
+ *             to save sbrk calls.
+ */
+static size_t grow_peak(size_t asize) {
+    if (asize > max_asize) {
+        max_asize = asize;
+    }
+
+    if (max_asize > 2 * asize) {
+        /* That max may just be a peak */
+        return asize * 2;
+    } else {
+        /* Otherwise it's very likely we're just about this level */
+        return max_asize;
+    }
+}
+
+/*
+ * grow_fixed - Round the miss up to whole GROW_CHUNKs.
+ */
+static size_t grow_fixed(size_t asize) {
+    return (asize + GROW_CHUNK - 1) & ~(size_t)(GROW_CHUNK - 1);
+}
+
+/*
+ * grow_geometric - Grow by 1/GROW_RATIO of the heap, or by the miss
+ *                  if that is more, so sbrk calls get rarer as the
+ *                  heap grows.
+ */
+static size_t grow_geometric(size_t asize) {
+    size_t step = (mem_heapsize() / GROW_RATIO) & ~(size_t)(DSIZE - 1);
+    return step > asize ? step : asize;
+}
+
+/*
+ * grow_ewma - Grow by the miss plus the moving average of past misses,
+ *             leaving room for about one more of the usual kind.
+ */
+static size_t grow_ewma(size_t asize) {
+    size_t room = miss_ewma & ~(size_t)(DSIZE - 1);
+    miss_ewma += ((long)asize - (long)miss_ewma) >> GROW_EWMA_SHIFT;
+    return asize + room;
+}
+
+/*
+ * grow_pattern - Grow by the miss alone, but once misses of one size
+ *                repeat, make room for as many more as came in a row,
+ *                up to GROW_RUN_MAX.
+ */
+static size_t grow_pattern(size_t asize) {
+    if (asize == miss_last) {
+        if (miss_run < GROW_RUN_MAX) {
+            miss_run++;
+        }
+    } else {
+        miss_last = asize;
+        miss_run = 1;
+    }
+    return asize * miss_run;
+}
+
+/*
+ * grow_heap - Extend heap by exactly asize bytes (a multiple of DSIZE).
+ *             Return the block pointer of the free block at heap top.
+ */
+static void* grow_heap(size_t asize) {
+    char* bp;
+    char* cbp;
+    if ((long)(bp = heap_sbrk(asize)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer, old epilogue knows prev */
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)))); /* Free header */
+    PUT(FTRP(bp), PACK(asize, 0));         /* Free block footer */
+    PUT(HDRP(NEXT_ABP(bp)), PACK(0, 1));   /* New epilogue header */
+
+    /* Coalesce if the previous block was free */
+    cbp = coalesce(bp);
+    if (cbp != bp && bp - DSIZE >= zero_lo) {
+        /* The old top footer and epilogue are inside the block now */
+        PUT(bp - DSIZE, 0);
+        PUT(bp - WSIZE, 0);
+    }
+    return cbp;
+}
+
+/*
+ * heap_sbrk - mem_sbrk for heap growth that keeps zero_lo. The new bytes
+ *             memlib never handed out before continue the zero stretch
+ *             if it reached the old brk, and start a new one otherwise.
+ *             Counts the call and the heap peak for mm_stats.
+ */
+static void* heap_sbrk(size_t incr) {
+    char* clean = mem_clean_lo();
+    char* old = mem_sbrk(incr);
+
+    sbrk_calls++;
+    if (old != (void *)-1 && (zero_lo > old || old < clean)) {
+        zero_lo = old > clean ? old : clean;
+    }
+    if (mem_heapsize() > heap_peak) {
+        heap_peak = mem_heapsize();
+    }
+    return old;
+}
+
+/*
+ * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ */
+static void* coalesce(char* bp) {
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char* prev_bp = prev_alloc ? NULL : PREV_ABP(bp);
+    char* next_bp = NEXT_ABP(bp);
+    int next_alloc = GET_ALLOC(HDRP(next_bp));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (prev_alloc && next_alloc) {            /* Cannot coalesce */
+        insert_node(bp, -1);
+        return bp;
+    }
+
+    else if (prev_alloc && !next_alloc) {      /* Coalesce next */
+        delete_node(next_bp, -1);
+        size += GET_SIZE(HDRP(next_bp));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size,0));
+        insert_node(bp, -1);
+    }
+
+    else if (!prev_alloc && next_alloc) {      /* Coalesce prev */
+        delete_node(prev_bp, -1);
+        size += GET_SIZE(HDRP(prev_bp));
+        bp = prev_bp;
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, 0));
+        insert_node(bp, -1);
+    }
+
+    else {                                     /* Coalesce both */
+        delete_node(prev_bp, -1);
+        delete_node(next_bp, -1);
+        size += GET_SIZE(HDRP(prev_bp)) +
+                GET_SIZE(HDRP(next_bp));
+        bp = prev_bp;
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, 0));
+        insert_node(bp, -1);
+    }
+
+    return bp;
+}
+
+/*
+ * free - Free a block
+ */
+void free(void *bp) {
+    int mt;
+    if (bp == 0) {
+        return;
+    }
+
+    if (free_listp == 0){
+        mm_init();
+    }
+
+    if (slab_owns(bp)) {
+        slab_run_t* run = SLAB_RUN(bp);
+        if (MT_ACTIVE() && tcache_keep(bp, run->osize)) {
+            return;
+        }
+        LOCK(&run->arena->lock, mt);
+        slab_free(bp);
+        UNLOCK(&run->arena->lock, mt);
+        return;
+    }
+
+    if (!GET_ALLOC(HDRP(bp))) {
+        return;
+    }
+
+    if (GET_MAPPED(HDRP(bp))) {
+        LOCK(&heap_lock, mt);
+        mem_unmap((char *)bp - DSIZE, GET_SIZE(HDRP(bp)));
+        map_count--;
+        UNLOCK(&heap_lock, mt);
+        return;
+    }
+
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (MT_ACTIVE() && tcache_keep(bp, size - WSIZE)) {
+        return;
+    }
+
+    LOCK(&heap_lock, mt);
+    quick_free(bp, size);
+    UNLOCK(&heap_lock, mt);
+}
+
+/*
+ * free_sized - Free bp, which was allocated with size bytes. A size
+ *              between the slab and mapping ranges can only belong to
+ *              a heap block, so the slab and mapping checks are skipped,
+ *              and the cache class comes from size as malloc rounds it,
+ *              not from the header. The block may be larger, by a tail
+ *              place() did not split off, which the class then ignores.
+ */
+void free_sized(void* bp, size_t size) {
+    int mt;
+    size_t asize;
+
+    if (bp == 0 || free_listp == 0 || size <= SLAB_MAX || size >= MMAP_MIN) {
+        free(bp);
+        return;
+    }
+
+    asize = adjust_size(size);
+#ifdef DEBUG
+    assert(GET_ALLOC(HDRP(bp)) && !GET_MAPPED(HDRP(bp)) &&
+           GET_SIZE(HDRP(bp)) >= asize);
+#endif
+    if (MT_ACTIVE() && tcache_keep(bp, asize - WSIZE)) {
+        return;
+    }
+
+    LOCK(&heap_lock, mt);
+    quick_free(bp, asize);
+    UNLOCK(&heap_lock, mt);
+}
+
+/*
+ * quick_free - Push small allocated heap block bp on the quick list of
+ *              size, at most its block size, without coalescing, and
+ *              merge the lists once they are full. Free larger blocks.
+ *              Blocks stay marked allocated on the lists, so alloc/free
+ *              churn of one size neither coalesces nor splits; the
+ *              lists are also merged before the heap is extended.
+ *              Caller holds heap_lock.
+ */
+static void quick_free(char* bp, size_t size) {
+    if (size > QUICK_MAX) {
+        free_block(bp);
+        return;
+    }
+
+    QL_NEXT(bp) = quick_head[size / DSIZE];
+    quick_head[size / DSIZE] = bp;
+    if ((quick_bytes += size) >= QUICK_LIMIT) {
+        quick_merge();
+    }
+}
+
+/*
+ * quick_merge - Free every block on the quick lists into the free lists,
+ *               coalescing as usual. Caller holds heap_lock.
+ */
+static void quick_merge(void) {
+    char* bp;
+    int i;
+
+    for (i = 0; i < QUICK_BINS; i++) {
+        while ((bp = quick_head[i]) != NULL) {
+            quick_head[i] = QL_NEXT(bp);
+            free_block(bp);
+        }
+    }
+    quick_bytes = 0;
+}
+
+/*
+ * free_block - Free allocated heap block bp. Caller holds heap_lock.
+ */
+static void free_block(char* bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_ABP(bp)));
+
+    bp = coalesce(bp);
+    if (GET_SIZE(HDRP(NEXT_ABP(bp))) == 0 &&
+        GET_SIZE(HDRP(bp)) >= TRIM_MIN) {
+        trim_heap(bp);
+    }
+}
+
+/*
+ * trim_heap - Shrink free block bp at the heap top to TRIM_KEEP bytes
+ *             and give the rest back with a negative mem_sbrk. Only a
+ *             top of TRIM_MIN bytes or more is trimmed; the gap between
+ *             the two keeps a heap that swings around one size from
+ *             shrinking and growing on every call.
+ */
+static void trim_heap(char* bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    sbrk_calls++;
+    if (mem_sbrk(-(int)(size - TRIM_KEEP)) == (void *)-1) {
+        return;
+    }
+
+    delete_node(bp, -1);
+    PUT(HDRP(bp), PACK(TRIM_KEEP, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(TRIM_KEEP, 0));
+    PUT(HDRP(NEXT_ABP(bp)), PACK(0, 1));    /* New epilogue */
+    insert_node(bp, -1);
 }
 
 /*
  * realloc - Reallocate size for oldptr. Copy old bytes into it.
  *           If size is 0, free it.
  *           If oldptr is NULL, malloc it.
+ *           Heap blocks are resized in place when resize_inplace can,
+ *           and mapped ones with mem_remap; only the rest are copied.
  */
 void* realloc(void* oldptr, size_t size) {
+    int mt;
     size_t oldsize;
     void *newptr;
 
@@ -450,6 +1459,34 @@ void* realloc(void* oldptr, size_t size) {
         return malloc(size);
     }
 
+    /* Too large for any block; the old one is left untouched */
+    if (size > MAP_MAX) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    if (slab_owns(oldptr)) {
+        oldsize = SLAB_RUN(oldptr)->osize;
+        if (size <= oldsize) {
+            return oldptr;  /* still fits its slot */
+        }
+    } else if (GET_MAPPED(HDRP(oldptr))) {
+        if (size >= MMAP_MIN) {
+            return remap_block(oldptr, size);
+        }
+        oldsize = GET_SIZE(HDRP(oldptr)) - DSIZE;
+    } else {
+        /* Shrink or grow without moving when we can */
+        int done;
+        LOCK(&heap_lock, mt);
+        done = resize_inplace(oldptr, adjust_size(size));
+        UNLOCK(&heap_lock, mt);
+        if (done) {
+            return oldptr;
+        }
+        oldsize = GET_SIZE(HDRP(oldptr)) - WSIZE;
+    }
+
     newptr = malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -458,7 +1495,6 @@ void* realloc(void* oldptr, size_t size) {
     }
 
     /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(oldptr));
     if (size < oldsize) oldsize = size;
     memcpy(newptr, oldptr, oldsize);
 
@@ -469,16 +1505,527 @@ void* realloc(void* oldptr, size_t size) {
 }
 
 /*
- * calloc - Allocate the block and set it to zero.
+ * resize_inplace - Resize allocated block bp to asize without moving it.
+ *                  bp may absorb a free successor, and the heap is
+ *                  extended when that leaves bp the last block.
+ *                  A tail of at least SPLIT_MIN is split off and freed.
+ *                  Return 1 on success, 0 if bp has to move.
+ */
+static int resize_inplace(char* bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    char* next = NEXT_ABP(bp);
+    int next_free = !GET_ALLOC(HDRP(next));
+    size_t avail = csize + (next_free ? GET_SIZE(HDRP(next)) : 0);
+    char* tail = next_free ? NEXT_ABP(next) : next;
+
+    if (avail < asize) {
+        /* Only the last block can grow past its neighbour */
+        if (GET_SIZE(HDRP(tail)) != 0 ||
+            heap_sbrk(asize - avail) == (void *)-1) {
+            return 0;
+        }
+        avail = asize;
+        PUT(HDRP(bp + asize), PACK(0, 1 | PREV_ALLOC)); /* New epilogue */
+    }
+
+    if (asize > csize) {
+        if (next_free) {
+            delete_node(next, -1);
+        }
+        csize = avail;
+    }
+
+    if (csize - asize >= SPLIT_MIN) {
+        PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+        next = NEXT_ABP(bp);
+        PUT(HDRP(next), PACK(csize - asize, PREV_ALLOC));
+        PUT(FTRP(next), PACK(csize - asize, 0));
+        CLR_PREV_ALLOC(HDRP(NEXT_ABP(next)));
+        coalesce(next);
+    } else {
+        PUT(HDRP(bp), PACK(csize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+        SET_PREV_ALLOC(HDRP(NEXT_ABP(bp)));
+    }
+    take_zero(bp);
+
+    return 1;
+}
+
+/*
+ * slab_owns - Return whether bp lies in a slab run.
+ */
+static int slab_owns(const void* bp) {
+    size_t page = ((const char *)bp - heap_lo) / RUN_SIZE;
+    return page < SLAB_PAGES &&
+           ((__atomic_load_n(&slab_pagemap[page / 64], __ATOMIC_RELAXED)
+             >> (page % 64)) & 1);
+}
+
+/*
+ * slab_malloc - Serve size from the calling thread's arena if its class
+ *               is warm, that is, has seen SLAB_WARMUP requests.
+ *               Objects carry no header; slab_pagemap tells free()
+ *               which pointers lie in runs.
+ *               Return NULL otherwise or on failure.
+ */
+static void* slab_malloc(size_t size) {
+    int mt;
+    arena_t* a = MT_ACTIVE() ? tcache_self()->arena : arenas[0];
+    slab_cls_t* c = &a->cls[SLAB_CLS(size)];
+    void* bp = NULL;
+
+    LOCK(&a->lock, mt);
+    if (c->nreqs == SLAB_WARMUP) {
+        bp = slab_alloc(a, SLAB_CLS(size));
+    } else {
+        c->nreqs++;
+    }
+    UNLOCK(&a->lock, mt);
+    return bp;
+}
+
+/*
+ * slab_new_run - Carve a new run for class cls of arena a out of the heap
+ *                and make it the class's only partial run.
+ *                Return NULL on failure. Caller holds a's lock.
+ */
+static slab_run_t* slab_new_run(arena_t* a, int cls) {
+    int mt;
+    LOCK(&heap_lock, mt);
+    slab_run_t* run = find_aligned(RUN_SIZE, RUN_SIZE);
+    if (run != NULL) {
+        size_t page = ((char *)run - heap_lo) / RUN_SIZE;
+        __atomic_fetch_or(&slab_pagemap[page / 64], 1ul << (page % 64),
+                          __ATOMIC_RELAXED);
+    }
+    UNLOCK(&heap_lock, mt);
+    if (run == NULL) {
+        return NULL;
+    }
+
+    int i;
+    run->arena = a;
+    run->next = run->prev = NULL;
+    run->osize = (cls + 1) * DSIZE;
+    run->recip = (unsigned int)((0xffffffffUL + run->osize) / run->osize);
+    run->nobjs = (RUN_SIZE - WSIZE - SLAB_HDR) / run->osize;
+    run->nfree = run->nobjs;
+    run->cls = cls;
+    run->hint = 0;
+    for (i = 0; i < SLAB_MAP_WORDS; i++) {
+        int left = run->nobjs - i * 64;
+        run->map[i] = left >= 64 ? ~0ul : left > 0 ? (1ul << left) - 1 : 0;
+    }
+
+    a->cls[cls].partial = run;
+    return run;
+}
+
+/*
+ * slab_alloc - Take the lowest free object of the first partial run of
+ *              class cls in arena a. Return NULL if no run can be made.
+ *              Caller holds a's lock.
+ */
+static void* slab_alloc(arena_t* a, int cls) {
+    slab_cls_t* c = &a->cls[cls];
+    slab_run_t* run = c->partial;
+    if (run == NULL && (run = slab_new_run(a, cls)) == NULL) {
+        return NULL;
+    }
+
+    int w = run->hint;
+    while (!run->map[w]) {
+        w++;
+    }
+    int bit = __builtin_ctzl(run->map[w]);
+    run->map[w] &= run->map[w] - 1;
+    run->hint = w;
+
+    if (--run->nfree == 0) {    /* run is full, drop it from partial */
+        c->partial = run->next;
+        if (run->next) {
+            run->next->prev = NULL;
+        }
+        run->next = NULL;
+    }
+
+    return (char *)run + SLAB_HDR + (w * 64 + bit) * run->osize;
+}
+
+/*
+ * slab_free - Return object bp to its run. A run that becomes empty is
+ *             freed to the heap unless it is its class's only partial run.
+ *             Caller holds the lock of the run's arena.
+ */
+static void slab_free(char* bp) {
+    int mt;
+    slab_run_t* run = SLAB_RUN(bp);
+    slab_cls_t* c = &run->arena->cls[run->cls];
+    size_t idx = ((bp - (char *)run - SLAB_HDR) * (size_t)run->recip) >> 32;
+    unsigned long bit = 1ul << (idx % 64);
+
+    if (run->map[idx / 64] & bit) {
+        return;     /* already free */
+    }
+    run->map[idx / 64] |= bit;
+    if (idx / 64 < run->hint) {
+        run->hint = idx / 64;
+    }
+
+    if (run->nfree++ == 0) {    /* was full, back to partial */
+        run->prev = NULL;
+        run->next = c->partial;
+        if (c->partial) {
+            c->partial->prev = run;
+        }
+        c->partial = run;
+    } else if (run->nfree == run->nobjs && (run->prev || run->next)) {
+        if (run->prev) {
+            run->prev->next = run->next;
+        } else {
+            c->partial = run->next;
+        }
+        if (run->next) {
+            run->next->prev = run->prev;
+        }
+
+        size_t page = ((char *)run - heap_lo) / RUN_SIZE;
+        LOCK(&heap_lock, mt);
+        __atomic_fetch_and(&slab_pagemap[page / 64], ~(1ul << (page % 64)),
+                           __ATOMIC_RELAXED);
+        free_block((char *)run);
+        UNLOCK(&heap_lock, mt);
+    }
+}
+
+/*
+ * tcache_destroy - Hand a dying thread's cached blocks back.
+ */
+static void tcache_destroy(void* arg) {
+    tcache_t* tc = arg;
+    int i;
+    if (tc->gen == heap_gen) {
+        for (i = 0; i < TCACHE_BINS; i++) {
+            tcache_flush(tc, i, tc->count[i]);
+        }
+    }
+    tc->gen = 0;
+}
+
+/*
+ * tcache_setup - Make the key that flushes caches and size the arena set
+ *                to the CPUs online.
+ */
+static void tcache_setup(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_key_create(&tcache_key, tcache_destroy);
+    narenas = ncpu < 1 ? 1 : ncpu * 2 > MAX_ARENAS ? MAX_ARENAS : ncpu * 2;
+}
+
+/*
+ * tcache_self - Return the calling thread's cache. A cache from before
+ *               the last mm_init starts over and the thread gets an arena,
+ *               round robin; arenas past the first are made here.
+ */
+static tcache_t* tcache_self(void) {
+    int mt;
+    tcache_t* tc = &tcache;
+    if (tc->gen == heap_gen) {
+        return tc;
+    }
+
+    pthread_once(&tcache_once, tcache_setup);
+    memset(tc, 0, sizeof(*tc));
+    tc->gen = heap_gen;
+    pthread_setspecific(tcache_key, tc);
+
+    LOCK(&heap_lock, mt);
+    int i = next_arena++ % narenas;
+    if (arenas[i] == NULL &&
+        (arenas[i] = malloc_block(adjust_size(sizeof(arena_t)))) != NULL) {
+        memset(arenas[i], 0, sizeof(arena_t));
+        pthread_mutex_init(&arenas[i]->lock, NULL);
+    }
+    tc->arena = arenas[i] ? arenas[i] : arenas[0];
+    UNLOCK(&heap_lock, mt);
+    return tc;
+}
+
+/*
+ * tcache_take - Pop a cached block with at least size usable bytes.
+ */
+static void* tcache_take(size_t size) {
+    tcache_t* tc = tcache_self();
+    int bin = (size + DSIZE - 1) / DSIZE;
+    char* bp = tc->head[bin];
+
+    if (bp != NULL) {
+        tc->head[bin] = TC_NEXT(bp);
+        tc->count[bin]--;
+    }
+    return bp;
+}
+
+/*
+ * tcache_keep - Cache allocated block bp with usable bytes of payload.
+ *               A full bin first hands its older half back.
+ *               Return 0 if bp is too big to be cached.
+ */
+static int tcache_keep(char* bp, size_t usable) {
+    if (usable > TCACHE_MAX) {
+        return 0;
+    }
+
+    tcache_t* tc = tcache_self();
+    int bin = usable / DSIZE;
+
+    if (tc->count[bin] == TCACHE_FILL) {
+        tcache_flush(tc, bin, TCACHE_FILL / 2);
+    }
+    TC_NEXT(bp) = tc->head[bin];
+    tc->head[bin] = bp;
+    tc->count[bin]++;
+    return 1;
+}
+
+/*
+ * tcache_flush - Hand the n oldest blocks of a bin back. Heap blocks are
+ *                freed under one hold of heap_lock, then slab objects
+ *                under their arenas' locks.
+ */
+static void tcache_flush(tcache_t* tc, int bin, int n) {
+    int mt;
+    char** link = &tc->head[bin];
+    char* slabs = NULL;
+    char* bp;
+    char* next;
+    int keep;
+
+    for (keep = tc->count[bin] - n; keep > 0; keep--) {
+        link = &TC_NEXT(*link);
+    }
+    bp = *link;
+    *link = NULL;
+    tc->count[bin] -= n;
+
+    LOCK(&heap_lock, mt);
+    for (; bp != NULL; bp = next) {
+        next = TC_NEXT(bp);
+        if (slab_owns(bp)) {
+            TC_NEXT(bp) = slabs;
+            slabs = bp;
+        } else {
+            free_block(bp);
+        }
+    }
+    UNLOCK(&heap_lock, mt);
+
+    arena_t* held = NULL;
+    for (bp = slabs; bp != NULL; bp = next) {
+        next = TC_NEXT(bp);
+        arena_t* a = SLAB_RUN(bp)->arena;
+        if (a != held) {
+            if (held) {
+                UNLOCK(&held->lock, mt);
+            }
+            LOCK(&a->lock, mt);
+            held = a;
+        }
+        slab_free(bp);
+    }
+    if (held) {
+        UNLOCK(&held->lock, mt);
+    }
+}
+
+/*
+ * calloc - Allocate the block and set it to zero. Fresh mappings and the
+ *          part of a heap block that was in the zero stretch are not
+ *          cleared again. Return NULL if nmemb * size overflows or
+ *          is more than any block holds.
  */
 void *calloc (size_t nmemb, size_t size)  {
-    size_t bytes = nmemb * size;
-    void *newptr;
+    int mt;
+    size_t bytes;
+    char* bp;
+    char* zero = NULL;      /* Payload from here on reads as zero */
+    char* ftr;
 
-    newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+    if (__builtin_mul_overflow(nmemb, size, &bytes) || bytes > MAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    return newptr;
+    if (free_listp == 0){
+        mm_init();
+    }
+
+    if (bytes >= MMAP_MIN) {
+        return map_block(bytes);
+    }
+
+    if (bytes <= SLAB_MAX || (MT_ACTIVE() && bytes <= TCACHE_MAX)) {
+        bp = malloc(bytes);
+    } else {
+        LOCK(&heap_lock, mt);
+        zero_from = NULL;
+        bp = malloc_block(adjust_size(bytes));
+        zero = zero_from;
+        UNLOCK(&heap_lock, mt);
+    }
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    if (zero == NULL || zero >= bp + bytes) {
+        memset(bp, 0, bytes);
+        return bp;
+    }
+
+    /* Clear what lies below the stretch and the free block words just
+     * past its start, and a footer the block may end with */
+    zero += ZERO_SLACK;
+    memset(bp, 0, (zero < bp + bytes ? zero : bp + bytes) - bp);
+    ftr = HDRP(NEXT_ABP(bp)) - WSIZE;
+    if (ftr >= zero && ftr < bp + bytes) {
+        PUT(ftr, 0);
+    }
+    return bp;
+}
+
+/*
+ * memalign - Allocate a block of at least size bytes whose payload is a
+ *            multiple of align, a power of 2. Aligned blocks always come
+ *            from the heap, never from slab or a mapping of their own.
+ */
+void* memalign(size_t align, size_t size) {
+    int mt;
+    char* bp;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= DSIZE) {
+        return malloc(size);
+    }
+
+    if (free_listp == 0){
+        mm_init();
+    }
+
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > MAX_HEAP || align > MAX_HEAP) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    LOCK(&heap_lock, mt);
+    bp = find_aligned(adjust_size(size), align);
+    UNLOCK(&heap_lock, mt);
+    return bp;
+}
+
+/*
+ * posix_memalign - Store an align-aligned block of size bytes in *memptr.
+ *                  align must be a power of 2 multiple of sizeof(void*).
+ *                  Return 0, EINVAL or ENOMEM.
+ */
+int posix_memalign(void** memptr, size_t align, size_t size) {
+    void* bp;
+
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    if ((bp = memalign(align, size)) == NULL && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * aligned_alloc - C11 aligned allocation, the same as memalign.
+ */
+void* aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+/*
+ * mm_stats - Fill in st with the free list counts, the largest free
+ *            block, and the heap and mapping counters. Blocks held by
+ *            slab runs and thread caches count as allocated.
+ */
+void mm_stats(mm_stats_t* st) {
+    int mt;
+    unsigned int bins;
+    char* bp;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    if (free_listp == 0) {
+        return;
+    }
+
+    LOCK(&heap_lock, mt);
+    for (i = 0; i < FL_SIZE; i++) {
+        st->free_count[i] = free_count[i];
+        st->free_bytes[i] = free_bytes[i];
+        st->free_total += free_bytes[i];
+    }
+
+    /* The largest block is in the last nonempty class */
+    if ((bins = seg_bitmap) != 0) {
+        i = 31 - __builtin_clz(bins);
+        if (i >= FL_LISTS) {
+            st->free_largest = tree_largest(free_listp[i]);
+        } else {
+            for (bp = free_listp[i]; bp != prologp; bp = NEXT_FBP(bp)) {
+                if (GET_SIZE(HDRP(bp)) > st->free_largest) {
+                    st->free_largest = GET_SIZE(HDRP(bp));
+                }
+            }
+        }
+    }
+
+    st->quick_bytes = quick_bytes;
+    st->heap_size = mem_heapsize();
+    st->heap_peak = heap_peak;
+    st->mapped_count = map_count;
+    st->mapped_bytes = mem_mapsize();
+    st->sbrk_calls = sbrk_calls;
+    st->map_calls = map_calls;
+    UNLOCK(&heap_lock, mt);
+}
+
+/*
+ * mm_walk - Call fn on every block between the prologue and the epilogue,
+ *           lowest address first. A block starts at its header. Quick
+ *           list blocks are reported as used, and slab runs as a whole.
+ */
+void mm_walk(mm_walk_fn fn, void* arg) {
+    int mt;
+    char* bp;
+    int kind;
+
+    if (free_listp == 0) {
+        return;
+    }
+
+    LOCK(&heap_lock, mt);
+    for (bp = NEXT_ABP(prologp); GET_SIZE(HDRP(bp)) != 0; bp = NEXT_ABP(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            kind = MM_BLOCK_FREE;
+        } else if (slab_owns(bp)) {
+            kind = MM_BLOCK_SLAB;
+        } else {
+            kind = MM_BLOCK_USED;
+        }
+        fn(arg, HDRP(bp), GET_SIZE(HDRP(bp)), kind);
+    }
+    UNLOCK(&heap_lock, mt);
 }
 
 
@@ -497,6 +2044,85 @@ static int aligned(const void *p) {
     return (size_t)ALIGN(p) == (size_t)p;
 }
 
+/*
+ * check_tree - Check the subtree at t of the trie of class segidx,
+ *              whose parent is parent and whose keys start with the
+ *              depth bits of prefix.
+ */
+static void check_tree(char* t, char* parent, int segidx, int depth,
+                       unsigned int prefix, int lineno) {
+    char* bp;
+
+    if (t == NULL) {
+        return;
+    }
+
+    if (PARENT(t) != parent) {
+        dbg_printf("[checker] - lineno %d - "
+                       "tree node %p 's parent isn't %p\n",
+                   lineno, t, parent);
+    }
+
+    if (depth > 0 &&
+        TREE_KEY(GET_SIZE(HDRP(t)), segidx) >> (32 - depth) != prefix) {
+        dbg_printf("[checker] - lineno %d - "
+                       "tree node %p of size %u is off its path\n",
+                   lineno, t, GET_SIZE(HDRP(t)));
+    }
+
+    bp = t;
+    do {
+        if (!in_heap(bp) || GET_ALLOC(HDRP(bp)) ||
+            find_segidx(GET_SIZE(HDRP(bp))) != segidx) {
+            dbg_printf("[checker] - lineno %d - "
+                           "bp %p in trie %d is not a free block of it\n",
+                       lineno, bp, segidx);
+        }
+        if (GET_SIZE(HDRP(bp)) != GET_SIZE(HDRP(t)) ||
+            PREV_FBP(NEXT_FBP(bp)) != bp || (bp != t && PARENT(bp) != NULL)) {
+            dbg_printf("[checker] - lineno %d - "
+                           "ring of tree node %p is broken at %p\n",
+                       lineno, t, bp);
+            break;
+        }
+        bp = NEXT_FBP(bp);
+    } while (bp != t);
+
+    check_tree(CHILD(t, 0), t, segidx, depth + 1, prefix << 1, lineno);
+    check_tree(CHILD(t, 1), t, segidx, depth + 1, (prefix << 1) | 1, lineno);
+}
+
+/*
+ * check_zero - Check block bp, which reaches past zero_lo, against the
+ *              zero stretch: it must be free, and read as zero from the
+ *              end of the slack to its footer. Only the first and last
+ *              few KB are read, to keep the check cheap on a large top.
+ */
+static void check_zero(char* bp, int lineno) {
+    char* lo = zero_lo + ZERO_SLACK > bp ? zero_lo + ZERO_SLACK : bp;
+    char* hi = FTRP(bp);
+    char* p;
+
+    if (GET_ALLOC(HDRP(bp))) {
+        dbg_printf("[checker] - lineno %d - "
+                       "allocated bp %p reaches past zero_lo %p\n",
+                   lineno, bp, zero_lo);
+        return;
+    }
+    for (p = lo; p < hi; p++) {
+        if (p == lo + 4096 && hi - p > 4096) {
+            p = hi - 4096;
+        }
+        if (*p != 0) {
+            dbg_printf("[checker] - lineno %d - "
+                           "byte %p of free bp %p in the zero stretch "
+                           "is not zero\n",
+                       lineno, p, bp);
+            return;
+        }
+    }
+}
+
 /*
  * mm_checkheap - Check validity of heap
  */
@@ -532,8 +2158,16 @@ void mm_checkheap(int lineno) {
     /* check heap */
     char* bp = prologp;
     int last_alloc = 1;
+    size_t count[FL_SIZE] = { 0 };
+    size_t bytes[FL_SIZE] = { 0 };
     while (1) {
         bp = NEXT_ABP(bp);
+        if (!GET_PREV_ALLOC(HDRP(bp)) != !last_alloc) {
+            dbg_printf("[checker] - lineno %d - "
+                           "prev alloc bit of bp %p is wrong\n",
+                       lineno, bp);
+        }
+
         if (GET_ALLOC(HDRP(bp)) && !GET_SIZE(HDRP(bp))) {  /* epilog */
             break;
         }
@@ -543,7 +2177,8 @@ void mm_checkheap(int lineno) {
                        lineno, bp);
         }
 
-        if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {
+        if (!GET_ALLOC(HDRP(bp)) &&
+            GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {
             dbg_printf("[checker] - lineno %d - "
                            "size of bp %p not consistent.\n",
                        lineno, bp);
@@ -552,7 +2187,7 @@ void mm_checkheap(int lineno) {
                        GET_SIZE(HDRP(bp)), GET_SIZE(FTRP(bp)));
         }
 
-        if (GET_ALLOC(HDRP(bp)) != GET_ALLOC(FTRP(bp))) {
+        if (!GET_ALLOC(HDRP(bp)) && GET_ALLOC(FTRP(bp))) {
             dbg_printf("[checker] - lineno %d - "
                            "alloc of bp %p not consistent\n",
                        lineno, bp);
@@ -564,6 +2199,14 @@ void mm_checkheap(int lineno) {
                        lineno, bp);
         }
         last_alloc = GET_ALLOC(HDRP(bp));
+        if (!last_alloc) {
+            count[find_segidx(GET_SIZE(HDRP(bp)))]++;
+            bytes[find_segidx(GET_SIZE(HDRP(bp)))] += GET_SIZE(HDRP(bp));
+        }
+
+        if (HDRP(NEXT_ABP(bp)) > zero_lo) {
+            check_zero(bp, lineno);
+        }
 
         if (NEXT_ABP(bp) == bp) {
             dbg_printf("[checker] - bp %p has zero size\n", bp);
@@ -571,9 +2214,41 @@ void mm_checkheap(int lineno) {
         }
     }
 
-    /* check free list */
+    /* check the free counters mm_stats reports */
     int i;
     for (i = 0; i < FL_SIZE; i++) {
+        if (count[i] != free_count[i] || bytes[i] != free_bytes[i]) {
+            dbg_printf("[checker] - lineno %d - "
+                           "class %d holds %zu blocks of %zu bytes, "
+                           "counted %zu of %zu\n",
+                       lineno, i, count[i], bytes[i],
+                       free_count[i], free_bytes[i]);
+        }
+    }
+
+    /* check quick lists */
+    size_t quick = 0;
+    for (i = 0; i < QUICK_BINS; i++) {
+        for (bp = quick_head[i]; bp != NULL; bp = QL_NEXT(bp)) {
+            if (!in_heap(bp) || !aligned(bp) || !GET_ALLOC(HDRP(bp)) ||
+                GET_SIZE(HDRP(bp)) < (size_t)i * DSIZE) {
+                dbg_printf("[checker] - lineno %d - "
+                               "bp %p on quick list %d is not an "
+                               "allocated block of its size\n",
+                           lineno, bp, i);
+                break;
+            }
+            quick += (size_t)i * DSIZE;
+        }
+    }
+    if (quick != quick_bytes) {
+        dbg_printf("[checker] - lineno %d - "
+                       "quick lists hold %zu bytes, not %zu\n",
+                   lineno, quick, quick_bytes);
+    }
+
+    /* check free list */
+    for (i = 0; i < FL_LISTS; i++) {
         bp = free_listp[i];
 
         while (1) {
@@ -603,11 +2278,9 @@ void mm_checkheap(int lineno) {
             }
 
             size_t minsz = i == 0 ? 0 : FL_MIN << (i-1);
-            size_t maxsz = i == FL_SIZE - 1 ?
-                           GET_SIZE(HDRP(bp)) :
-                           (unsigned) (FL_MIN << i);
+            size_t maxsz = (unsigned) (FL_MIN << i);  /* i < FL_SIZE-1 */
             if (GET_SIZE(HDRP(bp)) < minsz ||
-                GET_SIZE(HDRP(bp)) > maxsz) {
+                GET_SIZE(HDRP(bp)) >= maxsz) {
                 dbg_printf("[checker] - lineno %d - "
                                "bp %p is placed in a wrong seg list\n",
                            lineno, bp);
@@ -615,5 +2288,62 @@ void mm_checkheap(int lineno) {
 
             bp = next;
         }
+
+        if ((free_listp[i] != prologp) != !!(seg_bitmap & (1u << i))) {
+            dbg_printf("[checker] - lineno %d - "
+                           "bitmap bit of seg list %d is stale\n",
+                       lineno, i);
+        }
+    }
+
+    /* check tries */
+    for (i = FL_LISTS; i < FL_SIZE; i++) {
+        check_tree(free_listp[i], prologp, i, 0, 0, lineno);
+        if ((free_listp[i] != NULL) != !!(seg_bitmap & (1u << i))) {
+            dbg_printf("[checker] - lineno %d - "
+                           "bitmap bit of trie %d is stale\n",
+                       lineno, i);
+        }
+    }
+
+    /* check slab runs with free objects */
+    for (i = 0; i < MAX_ARENAS * SLAB_CLASSES; i++) {
+        arena_t* a = arenas[i / SLAB_CLASSES];
+        int cls = i % SLAB_CLASSES;
+        slab_run_t* run;
+        if (a == NULL) {
+            continue;
+        }
+        for (run = a->cls[cls].partial; run != NULL; run = run->next) {
+            int nfree = 0;
+            int w;
+            for (w = 0; w < SLAB_MAP_WORDS; w++) {
+                nfree += __builtin_popcountl(run->map[w]);
+                if (w < run->hint && run->map[w]) {
+                    dbg_printf("[checker] - lineno %d - "
+                                   "run %p has free objects below hint\n",
+                               lineno, run);
+                }
+            }
+
+            if (!slab_owns(run) || run->arena != a || run->cls != cls ||
+                run->osize != (unsigned int)(cls + 1) * DSIZE) {
+                dbg_printf("[checker] - lineno %d - "
+                               "run %p is not a class %d run\n",
+                           lineno, run, cls);
+            }
+
+            if (nfree != run->nfree || nfree == 0) {
+                dbg_printf("[checker] - lineno %d - "
+                               "run %p has %d free objects, says %d\n",
+                           lineno, run, nfree, run->nfree);
+            }
+
+            if (run->next && run->next->prev != run) {
+                dbg_printf("[checker] - lineno %d - "
+                               "run %p 's next's prev isn't run\n",
+                           lineno, run);
+            }
+        }
     }
 }
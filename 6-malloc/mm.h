@@ -7,6 +7,11 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_sized(void *ptr, size_t size);
 
 #else
 
@@ -15,10 +20,50 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign(size_t align, size_t size);
+extern int posix_memalign(void **memptr, size_t align, size_t size);
+extern void *aligned_alloc(size_t align, size_t size);
+extern size_t malloc_batch(size_t size, size_t n, void **out);
+extern void free_sized(void *ptr, size_t size);
 
 #endif
 
 extern int mm_init(void);
 
+/* Free blocks are counted in MM_STAT_CLASSES size classes: class 0 holds
+ * blocks below 16 bytes, class i blocks of [8 << i, 16 << i), and the
+ * last class everything larger */
+#define MM_STAT_CLASSES 16
+
+/* A snapshot of the allocator, filled in by mm_stats() */
+typedef struct {
+    size_t free_count[MM_STAT_CLASSES]; /* Free heap blocks per class */
+    size_t free_bytes[MM_STAT_CLASSES]; /* Their bytes per class */
+    size_t free_total;      /* Bytes in free heap blocks */
+    size_t free_largest;    /* Largest free heap block */
+    size_t quick_bytes;     /* Freed bytes still waiting on quick lists */
+    size_t heap_size;       /* Bytes between heap start and brk */
+    size_t heap_peak;       /* Largest heap_size since mm_init */
+    size_t mapped_count;    /* Blocks that have a mapping of their own */
+    size_t mapped_bytes;    /* Bytes in those mappings */
+    size_t sbrk_calls;      /* Calls that grew or trimmed the heap */
+    size_t map_calls;       /* Calls that mapped or remapped a block */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *st);
+
+/* Kinds of heap block mm_walk() reports */
+enum { MM_BLOCK_USED, MM_BLOCK_FREE, MM_BLOCK_SLAB };
+
+/* Called by mm_walk() with the start, size and kind of each block */
+typedef void (*mm_walk_fn)(void *arg, const void *start, size_t size,
+                           int kind);
+
+extern void mm_walk(mm_walk_fn fn, void *arg);
+
+/* Pick how far the heap grows on a miss; policy 0 is the default */
+extern int mm_set_growth(int policy);
+extern const char *mm_growth_name(int policy);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
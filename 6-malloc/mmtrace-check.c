@@ -0,0 +1,25 @@
+/*
+ * mmtrace-check.c - make check-mmtrace runs this under libmmtrace.so
+ *     and replays its trace with mdriver. It makes the requests a trace
+ *     has to adjust before mdriver can replay them.
+ */
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void)
+{
+    void *p[6];
+    int i;
+
+    p[0] = malloc(0);
+    p[1] = calloc(3, 0);
+    p[2] = realloc(NULL, 0);
+    p[3] = memalign(64, 0);
+    p[4] = malloc(100);
+    p[5] = realloc(malloc(10), 0);  /* frees, or shrinks to 0 bytes */
+    memset(p[4], 1, 100);
+    for (i = 0; i < 6; i++)
+        free(p[i]);
+    return 0;
+}
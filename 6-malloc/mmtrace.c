@@ -0,0 +1,619 @@
+/*
+ * mmtrace.c - an LD_PRELOAD library that records the malloc calls of a
+ *     program as a trace mdriver can replay
+ *
+ *     LD_PRELOAD=./libmmtrace.so MMTRACE_OUT=traces/prog.rep prog ...
+ *
+ * The trace is written when the program exits, to $MMTRACE_OUT, or to
+ * mmtrace.<pid>.rep without it. A %p in $MMTRACE_OUT becomes the pid.
+ * A name ending in .bin gets the binary format of tracefmt.h, so
+ * prog.rep.bin is mapped by mdriver -f prog.rep.
+ *
+ * Each call is logged as an event in a buffer of the calling thread,
+ * and no lock is taken. A buffer is a chunk of memory from mmap, pushed
+ * on a global list with compare-and-swap when the thread first needs
+ * it. A single atomic counter gives every event a sequence number,
+ * which fixes the order of the trace. free() takes its number before
+ * the block is released, malloc() after it got a block, so a block is
+ * always freed in the trace before it is handed out again. A moving
+ * realloc takes one number before the call, where the trace gets its
+ * 'r' line, and binds the new block to the id with another after it.
+ *
+ * At exit the events are put back in order and block addresses are
+ * mapped to trace ids, a new id for every block. Frees of blocks the
+ * trace never saw allocated, from before the library was loaded, are
+ * dropped, and so are requests of 4 GB or more, which a trace cannot
+ * hold. Requests of 0 bytes, which still return a block to free, are
+ * written as 1 byte, since mdriver takes a NULL from mm_malloc(0) for a
+ * failure. Blocks still allocated at exit are left so. Children of fork()
+ * are not traced, but programs they exec are, and inherit $MMTRACE_OUT.
+ * The first traced process puts its pid in $MMTRACE_PID, and any other
+ * process that finds a different pid there writes to its own file: the
+ * pid goes in before the first dot of the name, as prog.<pid>.rep, unless
+ * the name already has a %p.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "tracefmt.h"
+
+#define CHUNK_EVENTS   (1 << 16)    /* events per thread buffer chunk */
+#define BOOT_SIZE      4096         /* heap for dlsym() before the real calloc */
+#define MAXPATH        4096
+#define EV_BIND        OP_TYPES     /* event giving a moved block its id */
+#define TLS            __attribute__((tls_model("initial-exec")))
+
+/* One logged call */
+typedef struct {
+    uint64_t seq;       /* place in the trace */
+    void *ptr;          /* block returned, or handed to free/realloc */
+    void *newptr;       /* block realloc returned */
+    size_t size;        /* size asked for */
+    uint32_t align;     /* alignment of an aligned request */
+    int32_t type;       /* ALLOC, FREE, ..., or EV_BIND */
+    int32_t id;         /* trace id, set at exit */
+} event_t;
+
+/* A thread's buffer of events */
+typedef struct chunk {
+    struct chunk *next;         /* next on the global list */
+    uint32_t count;             /* events written, read at exit */
+    event_t ev[CHUNK_EVENTS];
+} chunk_t;
+
+/* Block address to trace id, open addressing */
+typedef struct {
+    void **key;
+    int32_t *id;
+    size_t cap, used;
+} idmap_t;
+
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static chunk_t *chunks;         /* every chunk, newest first */
+static uint64_t next_seq;       /* sequence number of the next event */
+static int tracing;             /* 1 from load until the trace is written */
+static pid_t traced_pid;        /* the process being traced */
+static int inherited;           /* 1 if a parent set $MMTRACE_PID */
+static int resolving;           /* nonzero while dlsym() runs */
+static char boot_heap[BOOT_SIZE];
+static size_t boot_used;
+static TLS __thread chunk_t *own;   /* chunk this thread writes into */
+static TLS __thread int inside;     /* nonzero inside the library */
+
+static void resolve(void);
+static void *boot_alloc(size_t size);
+static int in_boot(const void *ptr);
+static void stop_in_child(void);
+static event_t *log_events(int n);
+static void log_alloc(int type, void *ptr, size_t size, size_t align);
+static void write_trace(void);
+static const char *out_path(char *buf, size_t size);
+static int32_t idmap_take(idmap_t *m, void *key);
+static int idmap_put(idmap_t *m, void *key, int32_t id);
+static void *map_pages(size_t size);
+
+/*
+ * resolve - Look up the libc allocator. dlsym() may allocate while it
+ *     works, which boot_alloc() serves.
+ */
+static void resolve(void)
+{
+    inside++;
+    resolving++;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving--;
+    inside--;
+}
+
+/*
+ * boot_alloc - Hand out zeroed memory from boot_heap, which is never freed
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (size > BOOT_SIZE - boot_used)
+        return NULL;
+    p = boot_heap + boot_used;
+    boot_used += size;
+    return p;
+}
+
+/*
+ * in_boot - Return whether ptr came from boot_alloc()
+ */
+static int in_boot(const void *ptr)
+{
+    return (const char *)ptr >= boot_heap &&
+           (const char *)ptr < boot_heap + BOOT_SIZE;
+}
+
+/*
+ * mmtrace_start - Resolve the allocator and start tracing at load
+ */
+__attribute__((constructor))
+static void mmtrace_start(void)
+{
+    const char *owner;
+    char pid[16];
+
+    if (real_malloc == NULL)
+        resolve();
+    traced_pid = getpid();
+    inside++;
+    pthread_atfork(NULL, NULL, stop_in_child);
+    if ((owner = getenv("MMTRACE_PID")) != NULL) {
+        inherited = atoi(owner) != traced_pid;
+    } else {
+        snprintf(pid, sizeof(pid), "%d", (int)traced_pid);
+        setenv("MMTRACE_PID", pid, 1);
+    }
+    inside--;
+    __atomic_store_n(&tracing, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * stop_in_child - Stop tracing in the child of a fork
+ */
+static void stop_in_child(void)
+{
+    __atomic_store_n(&tracing, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * mmtrace_stop - Write the trace at exit
+ */
+__attribute__((destructor))
+static void mmtrace_stop(void)
+{
+    if (!__atomic_exchange_n(&tracing, 0, __ATOMIC_ACQ_REL))
+        return;
+    inside++;
+    write_trace();
+    inside--;
+}
+
+/*
+ * recording - Return whether the calling thread should log its call
+ */
+static inline int recording(void)
+{
+    return !inside && __atomic_load_n(&tracing, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * log_events - Return room for n consecutive events in this thread's
+ *     chunk, which the caller fills in and then commits by adding n to
+ *     the chunk count. NULL if no memory is left for a chunk.
+ */
+static event_t *log_events(int n)
+{
+    chunk_t *c = own, *head;
+
+    if (c == NULL || c->count + n > CHUNK_EVENTS) {
+        if ((c = map_pages(sizeof(chunk_t))) == NULL)
+            return NULL;
+        head = __atomic_load_n(&chunks, __ATOMIC_RELAXED);
+        do {
+            c->next = head;
+        } while (!__atomic_compare_exchange_n(&chunks, &head, c, 1,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        own = c;
+    }
+    return &c->ev[c->count];
+}
+
+/*
+ * commit - Publish the n events log_events() handed out
+ */
+static inline void commit(int n)
+{
+    __atomic_store_n(&own->count, own->count + n, __ATOMIC_RELEASE);
+}
+
+/*
+ * log_alloc - Log a call that handed out block ptr
+ */
+static void log_alloc(int type, void *ptr, size_t size, size_t align)
+{
+    event_t *ev;
+
+    if (ptr == NULL || (ev = log_events(1)) == NULL)
+        return;
+    ev->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    ev->type = type;
+    ev->ptr = ptr;
+    ev->size = size;
+    ev->align = align;
+    commit(1);
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+        if (resolving)
+            return boot_alloc(size);
+        resolve();
+    }
+    p = real_malloc(size);
+    if (recording())
+        log_alloc(ALLOC, p, size, 0);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+        if (resolving)
+            return nmemb && size > BOOT_SIZE / nmemb ?
+                   NULL : boot_alloc(nmemb * size);
+        resolve();
+    }
+    p = real_calloc(nmemb, size);
+    if (recording())
+        log_alloc(CALLOC, p, nmemb * size, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    event_t *ev;
+
+    if (in_boot(ptr))
+        return;
+    if (real_free == NULL)
+        resolve();
+    if (ptr != NULL && recording() && (ev = log_events(1)) != NULL) {
+        ev->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+        ev->type = FREE;
+        ev->ptr = ptr;
+        commit(1);
+    }
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    event_t *ev;
+    void *p;
+
+    if (real_realloc == NULL)
+        resolve();
+    if (in_boot(ptr)) {
+        /* libc never saw it, so copy it out; boot memory is never freed */
+        size_t left = boot_heap + BOOT_SIZE - (char *)ptr;
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, size < left ? size : left);
+        return p;
+    }
+    if (ptr == NULL || !recording() || (ev = log_events(2)) == NULL) {
+        p = real_realloc(ptr, size);
+        if (ptr == NULL && recording())
+            log_alloc(ALLOC, p, size, 0);
+        return p;
+    }
+
+    ev[0].seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    p = real_realloc(ptr, size);
+    ev[1].seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    ev[0].type = REALLOC;
+    ev[0].ptr = ptr;
+    ev[0].newptr = p;
+    ev[0].size = size;
+    ev[1].type = EV_BIND;
+    ev[1].ptr = p;
+    ev[1].id = -1;
+    commit(2);
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL)
+        resolve();
+    p = real_memalign(align, size);
+    if (recording())
+        log_alloc(ALIGNED, p, size, align);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    int err;
+
+    if (real_posix_memalign == NULL)
+        resolve();
+    err = real_posix_memalign(memptr, align, size);
+    if (err == 0 && recording())
+        log_alloc(ALIGNED, *memptr, size, align);
+    return err;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+        resolve();
+    p = real_aligned_alloc(align, size);
+    if (recording())
+        log_alloc(ALIGNED, p, size, align);
+    return p;
+}
+
+/*
+ * write_trace - Order the logged events, map blocks to ids, and write
+ *     the trace out
+ */
+static void write_trace(void)
+{
+    uint64_t nseq = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+    event_t **order, *ev;
+    traceop_t *ops, *op;
+    idmap_t ids = { 0 };
+    tracehdr_t hdr;
+    char path[MAXPATH];
+    const char *out;
+    uint32_t i, n;
+    uint64_t s;
+    int32_t id;
+    chunk_t *c;
+    FILE *fp;
+    int err;
+
+    if (nseq == 0)
+        return;
+    order = map_pages(nseq * sizeof(*order));
+    ops = map_pages(nseq * sizeof(*ops));
+    if (order == NULL || ops == NULL) {
+        fprintf(stderr, "mmtrace: no memory to write %llu events\n",
+                (unsigned long long)nseq);
+        return;
+    }
+
+    /* a slot stays empty if its call was still running */
+    for (c = __atomic_load_n(&chunks, __ATOMIC_ACQUIRE); c; c = c->next) {
+        n = __atomic_load_n(&c->count, __ATOMIC_ACQUIRE);
+        for (i = 0; i < n; i++)
+            if (c->ev[i].seq < nseq)
+                order[c->ev[i].seq] = &c->ev[i];
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.weight = 1;
+    for (s = 0; s < nseq; s++) {
+        if ((ev = order[s]) == NULL)
+            continue;
+        op = &ops[hdr.num_ops];
+        switch (ev->type) {
+        case ALLOC:
+        case CALLOC:
+        case ALIGNED:
+            if (ev->size > UINT32_MAX ||
+                idmap_put(&ids, ev->ptr, hdr.num_ids) < 0)
+                continue;
+            op->type = ev->type;
+            op->index = hdr.num_ids++;
+            /* the block of a 0 byte request is replayed as 1 byte, since
+               mm_malloc(0) hands out none */
+            op->size = ev->size ? ev->size : 1;
+            op->align = ev->align;
+            break;
+
+        case FREE:
+            if ((id = idmap_take(&ids, ev->ptr)) < 0)
+                continue;
+            op->type = FREE;
+            op->index = id;
+            break;
+
+        case REALLOC:
+            id = idmap_take(&ids, ev->ptr);
+            if (ev->newptr == NULL) {
+                /* realloc(p, 0) freed p; a failed one left it */
+                if (id < 0)
+                    continue;
+                if (ev->size != 0) {
+                    idmap_put(&ids, ev->ptr, id);
+                    continue;
+                }
+                op->type = FREE;
+                op->index = id;
+                break;
+            }
+            if (ev->size > UINT32_MAX)
+                continue;
+            /* a block from before the trace starts as a new one */
+            op->type = id < 0 ? ALLOC : REALLOC;
+            op->index = id < 0 ? hdr.num_ids++ : id;
+            op->size = ev->size ? ev->size : 1;
+            ev[1].id = op->index;
+            break;
+
+        case EV_BIND:
+            if (ev->id >= 0)
+                idmap_put(&ids, ev->ptr, ev->id);
+            continue;
+
+        default:
+            continue;
+        }
+        hdr.num_ops++;
+    }
+
+    out = out_path(path, sizeof(path));
+    n = strlen(out);
+    if (hdr.num_ops == 0) {
+        fprintf(stderr, "mmtrace: no requests to write to %s\n", out);
+    } else if (n > 4 && strcmp(out + n - 4, ".bin") == 0) {
+        trace_write_bin(out, &hdr, ops);
+    } else if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "mmtrace: %s: %s\n", out, strerror(errno));
+    } else {
+        trace_print(fp, &hdr, ops);
+        err = ferror(fp);
+        if (fclose(fp) != 0 || err)
+            fprintf(stderr, "mmtrace: %s: write failed\n", out);
+    }
+
+    munmap(order, nseq * sizeof(*order));
+    munmap(ops, nseq * sizeof(*ops));
+    munmap(ids.key, ids.cap * sizeof(*ids.key));
+    munmap(ids.id, ids.cap * sizeof(*ids.id));
+}
+
+/*
+ * out_path - Build the name of the trace of this process in buf, from
+ *     $MMTRACE_OUT with %p expanded and, in a process that inherited
+ *     it, the pid added, and return it
+ */
+static const char *out_path(char *buf, size_t size)
+{
+    const char *out = getenv("MMTRACE_OUT"), *base, *dot;
+    size_t n = 0;
+    int has_pid = 0;
+
+    if (out == NULL) {
+        snprintf(buf, size, "mmtrace.%d.rep", (int)traced_pid);
+        return buf;
+    }
+    for (; *out != '\0' && n + 1 < size; out++) {
+        if (out[0] == '%' && out[1] == 'p') {
+            n += snprintf(buf + n, size - n, "%d", (int)traced_pid);
+            if (n >= size)
+                n = size - 1;
+            has_pid = 1;
+            out++;
+        } else {
+            buf[n++] = *out;
+        }
+    }
+    buf[n] = '\0';
+    if (!inherited || has_pid)
+        return buf;
+
+    /* buf is out as is, so prog.rep.bin becomes prog.<pid>.rep.bin */
+    base = (base = strrchr(buf, '/')) != NULL ? base + 1 : buf;
+    if ((dot = strchr(base, '.')) == NULL || dot == base)
+        dot = buf + n;
+    n = dot - buf;
+    snprintf(buf + n, size - n, ".%d%s", (int)traced_pid,
+             getenv("MMTRACE_OUT") + n);
+    return buf;
+}
+
+/*
+ * idmap_slot - Return the slot of key in m, or the empty one it would go in
+ */
+static size_t idmap_slot(const idmap_t *m, void *key)
+{
+    size_t i = ((uintptr_t)key >> 4) * 0x9e3779b97f4a7c15ull;
+
+    for (i &= m->cap - 1; m->key[i] != NULL && m->key[i] != key;
+         i = (i + 1) & (m->cap - 1))
+        ;
+    return i;
+}
+
+/*
+ * idmap_put - Map key to id in m, growing it as needed. Return -1 if
+ *     there is no memory for it.
+ */
+static int idmap_put(idmap_t *m, void *key, int32_t id)
+{
+    idmap_t big;
+    size_t i, j;
+
+    if (2 * (m->used + 1) > m->cap) {
+        big.cap = m->cap ? 2 * m->cap : 1 << 16;
+        big.used = m->used;
+        big.key = map_pages(big.cap * sizeof(*big.key));
+        big.id = map_pages(big.cap * sizeof(*big.id));
+        if (big.key == NULL || big.id == NULL)
+            return -1;
+        for (i = 0; i < m->cap; i++) {
+            if (m->key[i] != NULL) {
+                j = idmap_slot(&big, m->key[i]);
+                big.key[j] = m->key[i];
+                big.id[j] = m->id[i];
+            }
+        }
+        if (m->cap) {
+            munmap(m->key, m->cap * sizeof(*m->key));
+            munmap(m->id, m->cap * sizeof(*m->id));
+        }
+        *m = big;
+    }
+    i = idmap_slot(m, key);
+    if (m->key[i] == NULL)
+        m->used++;
+    m->key[i] = key;
+    m->id[i] = id;
+    return 0;
+}
+
+/*
+ * idmap_take - Remove key from m and return its id, or -1 if absent
+ */
+static int32_t idmap_take(idmap_t *m, void *key)
+{
+    size_t i, j, k;
+    int32_t id;
+
+    if (m->cap == 0 || m->key[i = idmap_slot(m, key)] == NULL)
+        return -1;
+    id = m->id[i];
+
+    /* move later keys of the run back over the hole */
+    m->key[i] = NULL;
+    m->used--;
+    for (j = (i + 1) & (m->cap - 1); m->key[j] != NULL;
+         j = (j + 1) & (m->cap - 1)) {
+        k = idmap_slot(m, m->key[j]);
+        if (k != j) {
+            m->key[k] = m->key[j];
+            m->id[k] = m->id[j];
+            m->key[j] = NULL;
+        }
+    }
+    return id;
+}
+
+/*
+ * map_pages - Return size bytes of zeroed memory from mmap, or NULL
+ */
+static void *map_pages(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
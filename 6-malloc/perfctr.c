@@ -0,0 +1,129 @@
+/*
+ * perfctr.c - hardware event counts from perf_event_open
+ *
+ * Each event gets a counter of its own rather than a group, so that a
+ * machine missing one event still counts the others. The counters
+ * cover user mode in the calling thread only. When the kernel has to
+ * multiplex them, counts are scaled up by enabled over running time.
+ * Where perf events do not exist at all, perf_open() opens nothing and
+ * every count reads -1.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perfctr.h"
+
+#ifdef __linux__
+/* The perf type and config of each event */
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} perf_events[PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+#endif
+
+/*
+ * perf_open - Open a disabled counter for each event in pc. Return how
+ *     many opened; pc->err says why the first one that did not failed.
+ */
+int perf_open(perfctr_t *pc)
+{
+    int i, opened = 0;
+
+    pc->err = 0;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        pc->fd[i] = -1;
+#ifdef __linux__
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fd[i] >= 0)
+            opened++;
+        else if (pc->err == 0)
+            pc->err = errno;
+#else
+        if (pc->err == 0)
+            pc->err = ENOSYS;
+#endif
+    }
+    return opened;
+}
+
+/*
+ * perf_start - Zero and enable the counters of pc
+ */
+void perf_start(perfctr_t *pc)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (pc->fd[i] >= 0) {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/*
+ * perf_stop - Disable the counters of pc and read them into count,
+ *     which is -1 for an event with no counter or one that never ran
+ */
+void perf_stop(perfctr_t *pc, double count[PERF_EVENTS])
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+        count[i] = -1;
+#ifdef __linux__
+        unsigned long long val[3];  /* value, time enabled, time running */
+
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fd[i], val, sizeof(val)) == sizeof(val) && val[2] > 0)
+            count[i] = (double)val[0] * val[1] / val[2];
+#endif
+    }
+}
+
+/*
+ * perf_close - Close the counters of pc
+ */
+void perf_close(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (pc->fd[i] >= 0)
+            close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+}
@@ -0,0 +1,18 @@
+/*
+ * perfctr.h - hardware event counts around a piece of code, from the
+ *     Linux perf_event_open interface
+ */
+
+/* The events counted; an event the machine lacks is left out */
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES,
+       PERF_BRANCH_MISSES, PERF_DTLB_MISSES, PERF_EVENTS };
+
+typedef struct {
+    int fd[PERF_EVENTS];    /* counter of each event, or -1 */
+    int err;                /* errno of the first counter that failed */
+} perfctr_t;
+
+int perf_open(perfctr_t *pc);
+void perf_start(perfctr_t *pc);
+void perf_stop(perfctr_t *pc, double count[PERF_EVENTS]);
+void perf_close(perfctr_t *pc);
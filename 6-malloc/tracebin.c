@@ -0,0 +1,82 @@
+/*
+ * tracebin.c - Convert malloc traces to the binary sidecar format that
+ *     mdriver maps in place of the text, or print either kind as text.
+ *
+ *     tracebin traces/needle.rep ...   writes traces/needle.rep.bin ...
+ *     tracebin -t traces/needle.rep.bin   prints it as a .rep file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE 1024
+
+/*
+ * load - Read the text trace at path, or map it if it is binary
+ */
+static traceop_t *load(const char *path, tracehdr_t *hdr, size_t *len)
+{
+    size_t n = strlen(path), k = strlen(TRACE_BIN_SUFFIX);
+    traceop_t *ops;
+    FILE *fp;
+
+    if (n > k && strcmp(path + n - k, TRACE_BIN_SUFFIX) == 0)
+        return trace_map_bin(path, hdr, len);
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        return NULL;
+    }
+    ops = trace_parse(fp, path, hdr);
+    fclose(fp);
+    *len = 0;
+    return ops;
+}
+
+int main(int argc, char **argv)
+{
+    char bin[MAXLINE + sizeof(TRACE_BIN_SUFFIX)];
+    int print = 0, status = 0, c, i;
+    traceop_t *ops;
+    tracehdr_t hdr;
+    size_t len;
+
+    while ((c = getopt(argc, argv, "th")) != EOF) {
+        switch (c) {
+        case 't': /* Print the traces as text instead */
+            print = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: tracebin [-t] <trace>...\n");
+            fprintf(stderr, "\tWrite <trace>%s next to each text trace.\n",
+                    TRACE_BIN_SUFFIX);
+            fprintf(stderr, "\t-t  Print each text or binary trace as text.\n");
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+
+    for (i = optind; i < argc; i++) {
+        if ((ops = load(argv[i], &hdr, &len)) == NULL) {
+            fprintf(stderr, "%s: cannot read trace\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        if (print) {
+            trace_print(stdout, &hdr, ops);
+        } else {
+            snprintf(bin, sizeof(bin), "%s%s", argv[i], TRACE_BIN_SUFFIX);
+            if (trace_write_bin(bin, &hdr, ops) < 0)
+                status = 1;
+        }
+
+        if (len)
+            trace_unmap(ops, len);
+        else
+            free(ops);
+    }
+    return status;
+}
@@ -0,0 +1,331 @@
+/*
+ * tracefmt.c - reading and writing malloc traces, in the text .rep
+ *     format and the binary sidecar format described in tracefmt.h.
+ *
+ * Functions report problems on stderr and return NULL or -1.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE 1024
+
+static int newer(const struct stat *a, const struct stat *b);
+static int check_ops(const tracehdr_t *hdr, const traceop_t *ops);
+
+/*
+ * trace_load - Load the trace at path. Its binary sidecar is mapped
+ *     instead when it is at least as new as the text file; *len is then
+ *     the length to pass to trace_unmap(), and 0 if the ops were parsed
+ *     into memory that free() releases.
+ */
+traceop_t *trace_load(const char *path, tracehdr_t *hdr, size_t *len)
+{
+    char bin[MAXLINE + sizeof(TRACE_BIN_SUFFIX)];
+    struct stat text_st, bin_st;
+    traceop_t *ops;
+    FILE *fp;
+
+    snprintf(bin, sizeof(bin), "%s%s", path, TRACE_BIN_SUFFIX);
+    if (stat(bin, &bin_st) == 0 &&
+        (stat(path, &text_st) < 0 || !newer(&text_st, &bin_st)) &&
+        (ops = trace_map_bin(bin, hdr, len)) != NULL)
+        return ops;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    ops = trace_parse(fp, path, hdr);
+    fclose(fp);
+    *len = 0;
+    return ops;
+}
+
+/*
+ * newer - Return whether file a was modified after file b, to the
+ *     nanosecond, so a text trace edited within the second its sidecar
+ *     was written still counts as newer
+ */
+static int newer(const struct stat *a, const struct stat *b)
+{
+    return a->st_mtim.tv_sec != b->st_mtim.tv_sec ?
+           a->st_mtim.tv_sec > b->st_mtim.tv_sec :
+           a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+}
+
+/*
+ * trace_parse - Read a text trace from fp into hdr and a malloc'd op
+ *     array. The sizes of sized frees are filled in from the request
+ *     that last allocated their id.
+ */
+traceop_t *trace_parse(FILE *fp, const char *name, tracehdr_t *hdr)
+{
+    traceop_t *ops;
+    char type[MAXLINE];
+    int index, size, align, count;
+    int *id_sizes;
+    int max_index = 0;
+    int op_index;
+
+    memset(hdr, 0, sizeof(*hdr));
+    if (fscanf(fp, "%d %d %d %d", &hdr->weight, &hdr->num_ids,
+               &hdr->num_ops, &hdr->ignore_ranges) != 4) {
+        fprintf(stderr, "%s: truncated header\n", name);
+        return NULL;
+    }
+
+    if(hdr->weight < 0 || hdr->weight > 3) {
+        fprintf(stderr, "%s: weight can only be in {0, 1, 2 3}\n", name);
+        return NULL;
+    }
+    if(hdr->ignore_ranges != 0 && hdr->ignore_ranges != 1) {
+        fprintf(stderr, "%s: ignore-ranges can only be zero or one\n", name);
+        return NULL;
+    }
+
+    /* We'll store each request line in the trace in this array */
+    if ((ops = malloc(hdr->num_ops * sizeof(traceop_t))) == NULL) {
+        fprintf(stderr, "%s: out of memory for ops\n", name);
+        return NULL;
+    }
+
+    /* The last size each id got, which sized frees pass back */
+    if ((id_sizes = calloc(hdr->num_ids, sizeof(*id_sizes))) == NULL) {
+        fprintf(stderr, "%s: out of memory for ids\n", name);
+        free(ops);
+        return NULL;
+    }
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (op_index < hdr->num_ops && fscanf(fp, "%s", type) != EOF) {
+        memset(&ops[op_index], 0, sizeof(traceop_t));
+        switch(type[0]) {
+        case 'a':
+        case 'r':
+        case 'c':
+            fscanf(fp, "%u %u", &index, &size);
+            ops[op_index].type = type[0] == 'a' ? ALLOC :
+                                 type[0] == 'r' ? REALLOC : CALLOC;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'm':
+            fscanf(fp, "%u %u %u", &index, &size, &align);
+            if (align == 0 || (align & (align - 1)) != 0) {
+                fprintf(stderr, "%s: alignment %u is not a power of 2\n",
+                        name, align);
+                free(id_sizes);
+                free(ops);
+                return NULL;
+            }
+            ops[op_index].type = ALIGNED;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            ops[op_index].align = align;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'b':
+            fscanf(fp, "%u %u %u", &index, &size, &count);
+            ops[op_index].type = BATCH;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            ops[op_index].count = count;
+            index += count - 1;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'f':
+        case 's':
+            fscanf(fp, "%ud", &index);
+            ops[op_index].type = type[0] == 'f' ? FREE : SFREE;
+            ops[op_index].index = index;
+            break;
+        default:
+            fprintf(stderr, "%s: bogus type character (%c)\n",
+                    name, type[0]);
+            free(id_sizes);
+            free(ops);
+            return NULL;
+        }
+        if (ops[op_index].type == SFREE) {
+            ops[op_index].size =
+                (index >= 0 && index < hdr->num_ids) ? id_sizes[index] : 0;
+        } else if (ops[op_index].type != FREE && index < hdr->num_ids) {
+            for (count = ops[op_index].type == BATCH ?
+                     ops[op_index].count : 1; count > 0; count--)
+                id_sizes[index - count + 1] = size;
+        }
+        op_index++;
+    }
+    free(id_sizes);
+    assert(max_index == hdr->num_ids - 1);
+    assert(hdr->num_ops == op_index);
+
+    return ops;
+}
+
+/*
+ * trace_write_bin - Write hdr and ops as a binary trace to path.
+ *     The file is written under a temporary name and renamed into
+ *     place, so a reader never maps a partial one.
+ */
+int trace_write_bin(const char *path, const tracehdr_t *hdr,
+                    const traceop_t *ops)
+{
+    char tmp[MAXLINE + 8];
+    tracehdr_t out = *hdr;
+    FILE *fp;
+    int ok;
+
+    memcpy(out.magic, TRACE_MAGIC, sizeof(out.magic));
+    out.op_size = sizeof(traceop_t);
+    out.pad = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    ok = fwrite(&out, sizeof(out), 1, fp) == 1 &&
+         fwrite(ops, sizeof(traceop_t), out.num_ops, fp) ==
+         (size_t)out.num_ops;
+    ok &= fclose(fp) == 0;
+    if (!ok || rename(tmp, path) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * trace_map_bin - Map the binary trace at path read-only. Fill in hdr
+ *     and *len, the length of the mapping, and return the op array in
+ *     it, or NULL if the file is missing or not a binary trace of this
+ *     build.
+ */
+traceop_t *trace_map_bin(const char *path, tracehdr_t *hdr, size_t *len)
+{
+    struct stat st;
+    char *base;
+    int fd, i;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(tracehdr_t)) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    memcpy(hdr, base, sizeof(*hdr));
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->op_size != sizeof(traceop_t) || hdr->num_ops < 0 ||
+        (size_t)st.st_size != sizeof(tracehdr_t) +
+                              (size_t)hdr->num_ops * sizeof(traceop_t)) {
+        fprintf(stderr, "%s: not a binary trace of this build, ignored\n",
+                path);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    if ((i = check_ops(hdr, (traceop_t *)(base + sizeof(tracehdr_t)))) >= 0) {
+        fprintf(stderr, "%s: request %d is invalid, ignored\n",
+                path, i + 1);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    *len = st.st_size;
+    return (traceop_t *)(base + sizeof(tracehdr_t));
+}
+
+/*
+ * check_ops - Check once that every op of a mapped trace has a known
+ *     type, ids in 0..num_ids-1 and a power of 2 alignment, as the text
+ *     parser does, so the driver can index its block array and reduce
+ *     by the alignment unchecked. Frees may name id -1, which frees
+ *     NULL. Return the first bad op, or -1.
+ */
+static int check_ops(const tracehdr_t *hdr, const traceop_t *ops)
+{
+    const traceop_t *op;
+    int i;
+
+    if (hdr->num_ids < 0)
+        return 0;
+    for (i = 0; i < hdr->num_ops; i++) {
+        op = &ops[i];
+        if (op->type < 0 || op->type >= OP_TYPES ||
+            op->index < -1 || op->index >= hdr->num_ids)
+            return i;
+        if (op->index == -1 && op->type != FREE && op->type != SFREE)
+            return i;
+        if (op->type == BATCH &&
+            (op->count < 1 || op->count > hdr->num_ids - op->index))
+            return i;
+        if (op->type == ALIGNED &&
+            (op->align == 0 || (op->align & (op->align - 1)) != 0))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * trace_unmap - Unmap an op array from trace_map_bin()
+ */
+void trace_unmap(traceop_t *ops, size_t len)
+{
+    munmap((char *)ops - sizeof(tracehdr_t), len);
+}
+
+/*
+ * trace_print - Write hdr and ops to fp as a text trace
+ */
+void trace_print(FILE *fp, const tracehdr_t *hdr, const traceop_t *ops)
+{
+    int i;
+
+    fprintf(fp, "%d\n%d\n%d\n%d\n", hdr->weight, hdr->num_ids,
+            hdr->num_ops, hdr->ignore_ranges);
+    for (i = 0; i < hdr->num_ops; i++) {
+        switch (ops[i].type) {
+        case ALLOC:
+            fprintf(fp, "a %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case REALLOC:
+            fprintf(fp, "r %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case CALLOC:
+            fprintf(fp, "c %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case ALIGNED:
+            fprintf(fp, "m %d %u %u\n", ops[i].index, ops[i].size,
+                    ops[i].align);
+            break;
+        case BATCH:
+            fprintf(fp, "b %d %u %d\n", ops[i].index, ops[i].size,
+                    ops[i].count);
+            break;
+        case FREE:
+            fprintf(fp, "f %d\n", ops[i].index);
+            break;
+        case SFREE:
+            fprintf(fp, "s %d\n", ops[i].index);
+            break;
+        }
+    }
+}
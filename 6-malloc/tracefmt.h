@@ -0,0 +1,46 @@
+/*
+ * tracefmt.h - reading and writing malloc traces
+ *
+ * A trace is the text .rep file, or its binary sidecar: the same path
+ * with TRACE_BIN_SUFFIX appended. The sidecar is a tracehdr_t followed
+ * by the traceop_t array, in the byte order of the machine that wrote
+ * it, so it can be mapped and used in place.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_BIN_SUFFIX  ".bin"
+#define TRACE_MAGIC       "MMTRACE2"    /* bumped when a struct changes */
+
+/* Types of trace requests */
+enum { ALLOC, FREE, REALLOC, ALIGNED, BATCH, SFREE, CALLOC, OP_TYPES };
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int32_t type;                     /* type of request */
+    int32_t index;                    /* index for free() to use later */
+    uint32_t size;                    /* byte size of alloc/realloc request */
+    union {
+        uint32_t align;               /* alignment of an aligned request */
+        int32_t count;                /* blocks index.. of a batch request */
+    };
+} traceop_t;
+
+/* The header lines of a trace */
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC, in a binary trace only */
+    uint32_t op_size;    /* sizeof(traceop_t), in a binary trace only */
+    int32_t weight;      /* weight for this trace (unused) */
+    int32_t num_ids;     /* number of alloc/realloc ids */
+    int32_t num_ops;     /* number of distinct requests */
+    int32_t ignore_ranges;  /* header flag from when overlap checks were slow */
+    int32_t pad;
+} tracehdr_t;
+
+traceop_t *trace_load(const char *path, tracehdr_t *hdr, size_t *len);
+traceop_t *trace_parse(FILE *fp, const char *name, tracehdr_t *hdr);
+int trace_write_bin(const char *path, const tracehdr_t *hdr,
+                    const traceop_t *ops);
+traceop_t *trace_map_bin(const char *path, tracehdr_t *hdr, size_t *len);
+void trace_unmap(traceop_t *ops, size_t len);
+void trace_print(FILE *fp, const tracehdr_t *hdr, const traceop_t *ops);
@@ -0,0 +1,332 @@
+/*
+ * tracegen.c - Generate malloc traces from a workload model
+ *
+ *     tracegen -n 10M -p 32M -S pareto:1.2:16:64K -o traces/big.rep.bin
+ *
+ * Every allocation draws a size from the size distribution and a
+ * lifetime, counted in ops, from the lifetime distribution. A block is
+ * freed once its lifetime is up, or earlier when a new block would take
+ * the live bytes past the peak. A block due to die is instead grown by
+ * realloc with the realloc probability, and lives on. The trace is split
+ * into phases, and each phase scales sizes and lifetimes by factors of
+ * its own, so the load shifts over the trace. The last ops free whatever
+ * is still live. The same seed always gives the same trace.
+ *
+ * A name ending in .bin is written in the binary format of tracefmt.h,
+ * which mdriver maps as the sidecar of the name without it. Otherwise,
+ * and on stdout, the trace is text.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+#define MAX_SIZE   (1u << 30)   /* largest request generated */
+
+/* A distribution, parsed from the command line */
+typedef struct {
+    enum { UNIFORM, PARETO, BIMODAL, EXPONENTIAL } kind;
+    double a, b, c;
+} dist_t;
+
+/* A live block, keyed by when it dies */
+typedef struct {
+    uint64_t death;
+    int32_t id;
+} live_t;
+
+static uint64_t rng_state;
+
+/*
+ * rng - Return the next 64 random bits, from splitmix64
+ */
+static uint64_t rng(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/*
+ * uniform - Return a random double in (0, 1)
+ */
+static double uniform(void)
+{
+    return ((rng() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ * draw - Return a random value of d, times scale
+ */
+static double draw(const dist_t *d, double scale)
+{
+    double u = uniform(), v;
+
+    switch (d->kind) {
+    case UNIFORM:       /* min, max */
+        return scale * (d->a + u * (d->b - d->a));
+    case PARETO:        /* alpha, min, max or 0 for none */
+        v = scale * d->b * pow(u, -1 / d->a);
+        return d->c > 0 && v > scale * d->c ? scale * d->c : v;
+    case BIMODAL:       /* small, large, share of small; +-25% around each */
+        return scale * (uniform() < d->c ? d->a : d->b) * (0.75 + u / 2);
+    case EXPONENTIAL:   /* mean */
+        return -scale * d->a * log(u);
+    }
+    return 0;
+}
+
+/*
+ * parse_num - Parse a count with an optional K, M or G suffix
+ */
+static double parse_num(const char *s, const char **end)
+{
+    char *p;
+    double v = strtod(s, &p);
+
+    switch (*p) {
+    case 'K': case 'k': v *= 1 << 10; p++; break;
+    case 'M': case 'm': v *= 1 << 20; p++; break;
+    case 'G': case 'g': v *= 1 << 30; p++; break;
+    }
+    if (end != NULL)
+        *end = p;
+    else if (*p != '\0' || p == s)
+        v = -1;
+    return v;
+}
+
+/*
+ * parse_dist - Parse kind:a:b:c into d. Return -1 if it is not one.
+ */
+static int parse_dist(const char *s, dist_t *d)
+{
+    static const struct { const char *name; int kind, args; } kinds[] = {
+        { "uniform", UNIFORM, 2 }, { "pareto", PARETO, 3 },
+        { "bimodal", BIMODAL, 3 }, { "exp", EXPONENTIAL, 1 },
+    };
+    double v[3] = { 0 };
+    const char *p;
+    size_t i, len;
+    int n;
+
+    for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        len = strlen(kinds[i].name);
+        if (strncmp(s, kinds[i].name, len) == 0 && s[len] == ':')
+            break;
+    }
+    if (i == sizeof(kinds) / sizeof(kinds[0]))
+        return -1;
+
+    p = s + strlen(kinds[i].name);
+    for (n = 0; n < kinds[i].args; n++) {
+        if (*p++ != ':')
+            return -1;
+        v[n] = parse_num(p, &p);
+    }
+    if (*p != '\0' || v[0] <= 0)
+        return -1;
+    d->kind = kinds[i].kind;
+    d->a = v[0];
+    d->b = v[1];
+    d->c = v[2];
+    return 0;
+}
+
+/*
+ * heap_push - Add l to the min-heap of n live blocks
+ */
+static void heap_push(live_t *heap, size_t n, live_t l)
+{
+    size_t i = n, up;
+
+    for (; i > 0 && heap[up = (i - 1) / 2].death > l.death; i = up)
+        heap[i] = heap[up];
+    heap[i] = l;
+}
+
+/*
+ * heap_pop - Remove and return the block of n that dies first
+ */
+static live_t heap_pop(live_t *heap, size_t n)
+{
+    live_t top = heap[0], last = heap[--n];
+    size_t i = 0, kid;
+
+    while ((kid = 2 * i + 1) < n) {
+        if (kid + 1 < n && heap[kid + 1].death < heap[kid].death)
+            kid++;
+        if (heap[kid].death >= last.death)
+            break;
+        heap[i] = heap[kid];
+        i = kid;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-n ops] [-s seed] [-p peak] [-S dist] "
+            "[-L dist] [-P phases] [-r share] [-g factor] [-o file]\n");
+    fprintf(stderr, "\t-n <ops>     Requests in the trace (default 100K).\n");
+    fprintf(stderr, "\t-s <seed>    Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t-p <bytes>   Most bytes live at once (default 16M).\n");
+    fprintf(stderr, "\t-S <dist>    Request sizes (default pareto:1.3:16:64K).\n");
+    fprintf(stderr, "\t-L <dist>    Lifetimes in ops (default exp:1000).\n");
+    fprintf(stderr, "\t-P <n>       Phases with sizes and lifetimes scaled anew (default 1).\n");
+    fprintf(stderr, "\t-r <share>   Share of dying blocks grown by realloc instead (default 0).\n");
+    fprintf(stderr, "\t-g <factor>  Growth of each realloc (default 1.5).\n");
+    fprintf(stderr, "\t-o <file>    Write to <file>, binary if it ends in %s.\n",
+            TRACE_BIN_SUFFIX);
+    fprintf(stderr, "\tdist is uniform:min:max, pareto:alpha:min:max, "
+            "bimodal:small:large:share or exp:mean.\n");
+    fprintf(stderr, "\tA pareto max of 0 is no limit. Numbers take a K, M "
+            "or G suffix, in powers of 2.\n");
+}
+
+int main(int argc, char **argv)
+{
+    dist_t size_dist = { PARETO, 1.3, 16, 64 << 10 };
+    dist_t life_dist = { EXPONENTIAL, 1000, 0, 0 };
+    double ops = 100000, peak = 16 << 20, grow = 1.5, realloc_share = 0;
+    double size_scale = 1, life_scale = 1, v;
+    long phases = 1, phase = -1;
+    const char *out = NULL;
+    uint64_t live_bytes = 0, pending = 0;
+    uint32_t *sizes;
+    traceop_t *trace, *op;
+    tracehdr_t hdr;
+    live_t *heap, l;
+    size_t nlive = 0, n, len;
+    int c, have_pending = 0, status = 0;
+    FILE *fp;
+
+    rng_state = 1;
+    while ((c = getopt(argc, argv, "n:s:p:S:L:P:r:g:o:h")) != EOF) {
+        switch (c) {
+        case 'n': ops = parse_num(optarg, NULL); break;
+        case 's': rng_state = strtoull(optarg, NULL, 0); break;
+        case 'p': peak = parse_num(optarg, NULL); break;
+        case 'P': phases = atol(optarg); break;
+        case 'r': realloc_share = atof(optarg); break;
+        case 'g': grow = atof(optarg); break;
+        case 'o': out = optarg; break;
+        case 'S':
+            if (parse_dist(optarg, &size_dist) < 0) {
+                fprintf(stderr, "tracegen: bad size distribution %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'L':
+            if (parse_dist(optarg, &life_dist) < 0) {
+                fprintf(stderr, "tracegen: bad lifetime distribution %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            usage();
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (ops < 2 || ops > INT32_MAX || peak < 1 || phases < 1 || grow <= 1 ||
+        realloc_share < 0 || realloc_share >= 1) {
+        usage();
+        exit(1);
+    }
+
+    /* there are never more ids or live blocks than ops */
+    n = (size_t)ops;
+    trace = malloc(n * sizeof(*trace));
+    sizes = malloc(n * sizeof(*sizes));
+    heap = malloc(n * sizeof(*heap));
+    if (trace == NULL || sizes == NULL || heap == NULL) {
+        fprintf(stderr, "tracegen: out of memory for %zu ops\n", n);
+        exit(1);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.weight = 1;
+    while ((size_t)hdr.num_ops < n) {
+        op = &trace[hdr.num_ops];
+        memset(op, 0, sizeof(*op));
+
+        /* a phase draws its scales log-uniformly from 1/4 to 4 */
+        if (hdr.num_ops * phases / n != (size_t)phase) {
+            phase = hdr.num_ops * phases / n;
+            if (phase > 0) {
+                size_scale = pow(4, 2 * uniform() - 1);
+                life_scale = pow(4, 2 * uniform() - 1);
+            }
+        }
+        if (!have_pending) {
+            v = draw(&size_dist, size_scale);
+            pending = v < 1 ? 1 : v > MAX_SIZE ? MAX_SIZE : (uint64_t)v;
+            if (pending > peak)
+                pending = (uint64_t)peak;
+            have_pending = 1;
+        }
+
+        /* free when a block is due, the peak would be passed, or the
+           rest of the ops are needed to free the live blocks */
+        if (nlive > 0 && (nlive >= n - hdr.num_ops ||
+                          heap[0].death <= (uint64_t)hdr.num_ops ||
+                          live_bytes + pending > peak)) {
+            l = heap_pop(heap, nlive--);
+            v = sizes[l.id] * grow;
+            if (nlive + 1 < n - hdr.num_ops - 1 && uniform() < realloc_share &&
+                v <= MAX_SIZE && live_bytes + (uint64_t)v - sizes[l.id] <= peak) {
+                op->type = REALLOC;
+                live_bytes += (uint64_t)v - sizes[l.id];
+                sizes[l.id] = (uint32_t)v;
+                l.death = hdr.num_ops + 1 + (uint64_t)draw(&life_dist, life_scale);
+                heap_push(heap, nlive++, l);
+            } else {
+                op->type = FREE;
+                live_bytes -= sizes[l.id];
+            }
+            op->index = l.id;
+            op->size = op->type == REALLOC ? sizes[l.id] : 0;
+        } else {
+            op->type = ALLOC;
+            op->index = hdr.num_ids;
+            op->size = (uint32_t)pending;
+            sizes[hdr.num_ids] = op->size;
+            live_bytes += pending;
+            l.id = hdr.num_ids++;
+            l.death = hdr.num_ops + 1 + (uint64_t)draw(&life_dist, life_scale);
+            heap_push(heap, nlive++, l);
+            have_pending = 0;
+        }
+        hdr.num_ops++;
+    }
+
+    len = out ? strlen(out) : 0;
+    if (out && len > strlen(TRACE_BIN_SUFFIX) &&
+        strcmp(out + len - strlen(TRACE_BIN_SUFFIX), TRACE_BIN_SUFFIX) == 0) {
+        if (trace_write_bin(out, &hdr, trace) < 0)
+            status = 1;
+    } else if (out && (fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "tracegen: %s: %s\n", out, strerror(errno));
+        status = 1;
+    } else {
+        if (!out)
+            fp = stdout;
+        trace_print(fp, &hdr, trace);
+        if (ferror(fp) || (out && fclose(fp) != 0)) {
+            fprintf(stderr, "tracegen: write failed\n");
+            status = 1;
+        }
+    }
+
+    free(trace);
+    free(sizes);
+    free(heap);
+    return status;
+}